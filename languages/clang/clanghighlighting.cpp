@@ -24,6 +24,13 @@
 #include "duchain/macrodefinition.h"
 
 #include <language/duchain/topducontext.h>
+#include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
+
+#include <KTextEditor/Document>
+#include <KTextEditor/MovingInterface>
+#include <KTextEditor/MovingRange>
 
 using namespace KDevelop;
 
@@ -60,7 +67,96 @@ ClangHighlighting::ClangHighlighting(QObject* parent)
 {
 }
 
+ClangHighlighting::~ClangHighlighting()
+{
+    foreach (const auto& ranges, m_tokenHighlighting) {
+        qDeleteAll(ranges);
+    }
+}
+
 KDevelop::CodeHighlightingInstance* ClangHighlighting::createInstance() const
 {
     return new Instance(this);
 }
+
+void ClangHighlighting::highlightDUChain(ReferencedTopDUContext context)
+{
+    CodeHighlighting::highlightDUChain(context);
+
+    if (context) {
+        // queued after the DUChain highlighting got applied, which supersedes the token highlighting
+        queueTokenUpdate(context->url(), 0, {}, true);
+    }
+}
+
+void ClangHighlighting::highlightTokens(const IndexedString& document, qint64 revision,
+                                        const QVector<HighlightedToken>& tokens)
+{
+    queueTokenUpdate(document, revision, tokens, false);
+}
+
+void ClangHighlighting::discardTokenHighlighting(const IndexedString& document)
+{
+    queueTokenUpdate(document, 0, {}, true);
+}
+
+void ClangHighlighting::queueTokenUpdate(const IndexedString& document, qint64 revision,
+                                         const QVector<HighlightedToken>& tokens, bool clear)
+{
+    QMutexLocker lock(&m_tokenUpdatesMutex);
+    if (m_tokenUpdates.isEmpty()) {
+        QMetaObject::invokeMethod(this, "processTokenUpdates", Qt::QueuedConnection);
+    }
+    m_tokenUpdates.append({document, revision, tokens, clear});
+}
+
+void ClangHighlighting::processTokenUpdates()
+{
+    QVector<TokenUpdate> updates;
+    {
+        QMutexLocker lock(&m_tokenUpdatesMutex);
+        updates.swap(m_tokenUpdates);
+    }
+
+    foreach (const auto& update, updates) {
+        clearTokenHighlighting(update.document);
+        if (update.clear) {
+            continue;
+        }
+
+        auto document = ICore::self()->documentController()->documentForUrl(update.document.toUrl());
+        auto textDocument = document ? document->textDocument() : nullptr;
+        auto movingInterface = qobject_cast<KTextEditor::MovingInterface*>(textDocument);
+        if (!movingInterface || movingInterface->revision() != update.revision) {
+            // the document changed in the meantime, wait for the DUChain highlighting instead
+            continue;
+        }
+
+        connect(textDocument, SIGNAL(aboutToInvalidateMovingInterfaceContent(KTextEditor::Document*)),
+                this, SLOT(documentAboutToBeInvalidated(KTextEditor::Document*)), Qt::UniqueConnection);
+        connect(textDocument, SIGNAL(aboutToDeleteMovingInterfaceContent(KTextEditor::Document*)),
+                this, SLOT(documentAboutToBeInvalidated(KTextEditor::Document*)), Qt::UniqueConnection);
+
+        auto& ranges = m_tokenHighlighting[update.document];
+        ranges.reserve(update.tokens.size());
+        foreach (const auto& token, update.tokens) {
+            auto range = movingInterface->newMovingRange(token.range);
+            range->setAttribute(attributeForType(token.type, token.context, QColor()));
+            ranges.append(range);
+        }
+    }
+}
+
+void ClangHighlighting::clearTokenHighlighting(const IndexedString& document)
+{
+    auto it = m_tokenHighlighting.find(document);
+    if (it != m_tokenHighlighting.end()) {
+        qDeleteAll(*it);
+        m_tokenHighlighting.erase(it);
+    }
+}
+
+void ClangHighlighting::documentAboutToBeInvalidated(KTextEditor::Document* document)
+{
+    clearTokenHighlighting(IndexedString(document->url()));
+}
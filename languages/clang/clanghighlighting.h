@@ -24,16 +24,72 @@
 
 #include <language/highlighting/codehighlighting.h>
 
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+
+#include "duchain/tokenhighlighting.h"
+
+namespace KTextEditor {
+class Document;
+class MovingRange;
+}
+
 class ClangHighlighting : public KDevelop::CodeHighlighting
 {
     Q_OBJECT
 public:
     explicit ClangHighlighting(QObject* parent);
+    ~ClangHighlighting() override;
 
     KDevelop::CodeHighlightingInstance* createInstance() const override;
 
+    void highlightDUChain(KDevelop::ReferencedTopDUContext context) override;
+
+    /**
+     * Highlight the @p tokens of @p document until the highlighting of its DUChain is available
+     *
+     * This gives quick feedback for open documents while their DUChain is still being built.
+     * The tokens are dropped if @p document changed since @p revision of its moving interface.
+     *
+     * NOTE: This is thread safe.
+     */
+    void highlightTokens(const KDevelop::IndexedString& document, qint64 revision,
+                         const QVector<HighlightedToken>& tokens);
+
+    /**
+     * Drop the token highlighting of @p document without waiting for the highlighting of its DUChain
+     *
+     * Used when the parse job that highlighted the tokens ends without highlighting the DUChain.
+     *
+     * NOTE: This is thread safe.
+     */
+    void discardTokenHighlighting(const KDevelop::IndexedString& document);
+
+private slots:
+    void processTokenUpdates();
+    void documentAboutToBeInvalidated(KTextEditor::Document* document);
+
 private:
     class Instance;
+
+    /// Queue an update of the token highlighting, the DUChain highlighting replaces it if @p clear is true
+    void queueTokenUpdate(const KDevelop::IndexedString& document, qint64 revision,
+                          const QVector<HighlightedToken>& tokens, bool clear);
+    void clearTokenHighlighting(const KDevelop::IndexedString& document);
+
+    struct TokenUpdate
+    {
+        KDevelop::IndexedString document;
+        qint64 revision;
+        QVector<HighlightedToken> tokens;
+        bool clear;
+    };
+
+    QMutex m_tokenUpdatesMutex;
+    QVector<TokenUpdate> m_tokenUpdates;
+    /// The ranges highlighted from tokens, only accessed from the main thread
+    QHash<KDevelop::IndexedString, QVector<KTextEditor::MovingRange*>> m_tokenHighlighting;
 };
 
 #endif // CLANG_CLANGHIGHLIGHTING_H
@@ -27,6 +27,7 @@
 #include <interfaces/iproject.h>
 #include <interfaces/ilanguagecontroller.h>
 #include <interfaces/idocumentcontroller.h>
+#include <interfaces/idocument.h>
 
 #include <language/interfaces/icodehighlighting.h>
 
@@ -51,22 +52,35 @@
 #include "duchain/clangindex.h"
 #include "duchain/clangparsingenvironmentfile.h"
 #include "util/clangdebug.h"
+#include "util/clangtrace.h"
 #include "util/clangtypes.h"
 
 #include "clangsupport.h"
+#include "clanghighlighting.h"
+#include "duchain/tokenhighlighting.h"
 #include "duchain/documentfinderhelpers.h"
+#include "duchain/unsavedfilecache.h"
 
+#include <QDir>
 #include <QFile>
 #include <QStringList>
 #include <QFileInfo>
 #include <QReadLocker>
 #include <QProcess>
+#include <algorithm>
 #include <memory>
 
+#include <KTextEditor/Document>
+#include <KTextEditor/MovingInterface>
+#include <KTextEditor/View>
+
 using namespace KDevelop;
 
 namespace {
 
+/// The number of lines around the cursor that get highlighted before the DUChain is built
+const int tokenHighlightingLines = 100;
+
 QString findConfigFile(const QString& forFile, const QString& configFileName)
 {
     QDir dir = QFileInfo(forFile).dir();
@@ -156,6 +170,100 @@ DocumentChangeTracker* trackerForUrl(const IndexedString& url)
     return ICore::self()->languageController()->backgroundParser()->trackerForUrl(url);
 }
 
+/**
+ * @return true when @p url changed on disk since its context was built, in which case
+ *         @p fingerprint is set to the content fingerprint of that context
+ */
+bool changedOnDisk(const IndexedString& url, uint* fingerprint)
+{
+    DUChainReadLocker lock;
+    auto context = DUChainUtils::standardContextForUrl(url.toUrl());
+    auto file = context ? parsingEnvironmentFile(context) : nullptr;
+    if (!file || file->modificationRevision() == ModificationRevision::revisionForFile(url)) {
+        return false;
+    }
+    *fingerprint = file->contentFingerprint();
+    return true;
+}
+
+uint contentFingerprint(const IndexedString& url)
+{
+    DUChainReadLocker lock;
+    auto context = DUChainUtils::standardContextForUrl(url.toUrl());
+    auto file = context ? parsingEnvironmentFile(context) : nullptr;
+    return file ? file->contentFingerprint() : 0;
+}
+
+/**
+ * @return true when any of @p documents is part of @p unit
+ */
+bool includesAnyDocument(CXTranslationUnit unit, const QList<IndexedString>& documents)
+{
+    return std::any_of(documents.begin(), documents.end(), [unit] (const IndexedString& document) {
+        return clang_getFile(unit, document.byteArray().constData());
+    });
+}
+
+bool isGuardedAgainstMultipleInclusion(CXTranslationUnit unit, CXFile file)
+{
+#if CINDEX_VERSION_MINOR > 30
+    return clang_isFileMultipleIncludeGuarded(unit, file);
+#else
+    // we can't tell, so be conservative
+    Q_UNUSED(unit);
+    Q_UNUSED(file);
+    return false;
+#endif
+}
+
+/**
+ * @return the start of the contents of @p tu, taken from @p unsavedFiles if it has unsaved changes
+ */
+QByteArray leadingContents(const IndexedString& tu, const QVector<UnsavedFile>& unsavedFiles)
+{
+    // the leading includes are at the start of the file, don't read more than we need
+    const int maxSize = 64 * 1024;
+    const auto path = tu.str();
+    auto it = std::find_if(unsavedFiles.begin(), unsavedFiles.end(), [&path] (const UnsavedFile& file) {
+        return file.fileName() == path;
+    });
+    if (it != unsavedFiles.end()) {
+        return it->contents().left(maxSize);
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return file.read(maxSize);
+}
+
+/**
+ * @return the leading includes of the translation unit of @p session, resolved via @p imports
+ *
+ * @p contents is the start of the translation unit as it was parsed.
+ * Only includes of headers that can be precompiled into a shared preamble are returned.
+ */
+QVector<SharedPreambles::Include> shareableLeadingIncludes(const ParseSession& session, const Imports& imports,
+                                                          const QByteArray& contents)
+{
+    auto includes = SharedPreambles::leadingIncludes(contents);
+
+    const auto mainImports = imports.values(session.mainFile());
+    for (int i = 0; i < includes.size(); ++i) {
+        auto& include = includes[i];
+        auto it = std::find_if(mainImports.begin(), mainImports.end(), [&include] (const Import& import) {
+            return import.location.line == include.line;
+        });
+        if (it == mainImports.end() || !isGuardedAgainstMultipleInclusion(session.unit(), it->file)) {
+            includes.resize(i);
+            break;
+        }
+        include.path = IndexedString(QFileInfo(ClangString(clang_getFileName(it->file)).toString()).canonicalFilePath());
+    }
+    return includes;
+}
+
 }
 
 ClangParseJob::ClangParseJob(const IndexedString& url, ILanguageSupport* languageSupport)
@@ -194,11 +302,23 @@ ClangParseJob::ClangParseJob(const IndexedString& url, ILanguageSupport* languag
         {
             continue;
         }
-        m_unsavedFiles << UnsavedFile(textDocument->url().toLocalFile(), textDocument->textLines(textDocument->documentRange()));
+        // shared with other parse jobs and code completion, only re-encoded when the document changed
+        m_unsavedFiles << clang()->index()->unsavedFileCache()->unsavedFile(textDocument);
         const IndexedString indexedUrl(textDocument->url());
         m_unsavedRevisions.insert(indexedUrl, ModificationRevision::revisionForFile(indexedUrl));
     }
 
+    if (auto document = ICore::self()->documentController()->documentForUrl(url.toUrl())) {
+        auto movingInterface = qobject_cast<KTextEditor::MovingInterface*>(document->textDocument());
+        auto view = document->activeTextView();
+        if (movingInterface && view) {
+            // highlight the lines around the cursor directly from the tokens, see ClangHighlighting::highlightTokens
+            const int line = view->cursorPosition().line();
+            m_tokenHighlightingRange = {qMax(0, line - tokenHighlightingLines), 0, line + tokenHighlightingLines, 0};
+            m_tokenHighlightingRevision = movingInterface->revision();
+        }
+    }
+
     if (auto tracker = trackerForUrl(url)) {
         tracker->reset();
     }
@@ -211,7 +331,10 @@ ClangSupport* ClangParseJob::clang() const
 
 void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread* /*thread*/)
 {
+    ClangTrace::Scope trace("ClangParseJob::run", document());
+    ClangTrace::Scope parseLockTrace("wait for parse lock", ClangTrace::Scope::LockWait);
     QReadLocker parseLock(languageSupport()->parseLock());
+    parseLockTrace.finish();
 
     if (abortRequested()) {
         return;
@@ -222,22 +345,42 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
         m_environment.addIncludes(IDefinesAndIncludesManager::manager()->includesInBackground(tuUrlStr));
         m_environment.addDefines(IDefinesAndIncludesManager::manager()->definesInBackground(tuUrlStr));
         m_environment.setPchInclude(userDefinedPchIncludeForFile(tuUrlStr));
+        if (!m_environment.pchInclude().isValid()) {
+            // precompile the leading includes this TU shares with many others, if any
+            // match against the contents that get parsed, which may be unsaved
+            const auto& tuUrl = m_environment.translationUnitUrl();
+            auto sharedPreambles = clang()->index()->sharedPreambles();
+            m_environment.setPchInclude(sharedPreambles->preambleForTranslationUnit(m_environment.hash(), tuUrl,
+                                                                                    leadingContents(tuUrl, m_unsavedFiles)));
+        }
     }
 
     if (abortRequested()) {
         return;
     }
 
-    // NOTE: we must have all declarations, contexts and uses available for files that are opened in the editor
-    //       it is very hard to check this for all included files of this TU, and previously lead to problems
-    //       when we tried to skip function bodies as an optimization for files that where not open in the editor.
-    //       now, we always build everything, which is correct but a tad bit slower. we can try to optimize later.
-    setMinimumFeatures(static_cast<TopDUContext::Features>(minimumFeatures() | TopDUContext::AllDeclarationsContextsAndUses));
+    // NOTE: we must have all declarations, contexts and uses available for files that are opened in the editor.
+    //       when neither this TU nor any of its files are open, and only the visible declarations and contexts
+    //       where requested, we skip function bodies which makes background indexing much cheaper. once such
+    //       a file gets opened, ClangSupport::documentActivated schedules a full reparse.
+    const bool skipFunctionBodies = canSkipFunctionBodies();
+    if (!skipFunctionBodies) {
+        setMinimumFeatures(static_cast<TopDUContext::Features>(minimumFeatures() | TopDUContext::AllDeclarationsContextsAndUses));
+    }
 
     if (minimumFeatures() & AttachASTWithoutUpdating) {
         // The context doesn't need to be updated, but has no AST attached (restored from disk),
         // so attach AST to it, without updating DUChain
-        ParseSession session(createSessionData());
+        ParseSessionData::Ptr sessionData;
+        auto cache = clang()->index()->translationUnitCache();
+        if (!(minimumFeatures() & SkipTranslationUnitCache) && m_unsavedFiles.isEmpty()) {
+            sessionData = cache->load(m_environment, clang()->index());
+        }
+        const bool restored = sessionData;
+        if (!restored) {
+            sessionData = createSessionData();
+        }
+        ParseSession session(sessionData);
 
         DUChainWriteLocker lock;
         auto ctx = DUChainUtils::standardContextForUrl(document().toUrl());
@@ -251,11 +394,18 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
             lock.unlock();
             languageSupport()->codeHighlighting()->highlightDUChain(ctx);
         }
+        if (restored) {
+            // a unit loaded from disk can neither be reparsed nor used for code completion, so replace it in the background
+            const auto features = static_cast<TopDUContext::Features>(minimumFeatures() | SkipTranslationUnitCache);
+            ICore::self()->languageController()->backgroundParser()->addDocument(document(), features, BackgroundParser::InitialParsePriority);
+        }
         return;
     }
 
     {
+        ClangTrace::Scope urlLockTrace("wait for URL parse lock", ClangTrace::Scope::LockWait);
         UrlParseLock urlLock(document());
+        urlLockTrace.finish();
         if (abortRequested() || !isUpdateRequired(ParseSession::languageString())) {
             return;
         }
@@ -267,7 +417,14 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
     }
 
     if (!session.data() || !session.reparse(m_unsavedFiles, m_environment)) {
-        session.setData(createSessionData());
+        session.setData(createSessionData(skipFunctionBodies ? ParseSessionData::SkipFunctionBodies : ParseSessionData::NoOption));
+        if (skipFunctionBodies && session.unit()
+            && includesAnyDocument(session.unit(), ICore::self()->languageController()->backgroundParser()->managedDocuments()))
+        {
+            // without a previous DUChain, canSkipFunctionBodies can't know all files of the TU
+            setMinimumFeatures(static_cast<TopDUContext::Features>(minimumFeatures() | TopDUContext::AllDeclarationsContextsAndUses));
+            session.setData(createSessionData());
+        }
     }
 
     if (!session.unit()) {
@@ -289,9 +446,31 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
         return;
     }
 
+    bool tokensHighlighted = false;
+    if (m_tokenHighlightingRange.isValid()) {
+        // give quick feedback while the DUChain gets built, its highlighting replaces this one afterwards
+        ClangTrace::Scope highlightTrace("token highlighting");
+        auto file = clang_getFile(session.unit(), document().byteArray().constData());
+        clang()->highlighting()->highlightTokens(document(), m_tokenHighlightingRevision,
+                                                 TokenHighlighting::highlightedTokens(session.unit(), file, m_tokenHighlightingRange));
+        tokensHighlighted = true;
+    }
+    // otherwise the token highlighting stays on top of the outdated DUChain highlighting
+    auto discardTokenHighlighting = [&]() {
+        if (tokensHighlighted) {
+            clang()->highlighting()->discardTokenHighlighting(document());
+            tokensHighlighted = false;
+        }
+    };
+
     Imports imports = ClangHelpers::tuImports(session.unit());
     IncludeFileContexts includedFiles;
-    if (auto pch = clang()->index()->pch(m_environment)) {
+    // the PCH got validated when the unit was created, only look it up again when it got evicted meanwhile
+    auto pch = session.pch();
+    if (!pch && m_environment.pchInclude().isValid()) {
+        pch = clang()->index()->pch(m_environment);
+    }
+    if (pch) {
         auto pchFile = pch->mapFile(session.unit());
         includedFiles = pch->mapIncludes(session.unit());
         includedFiles.insert(pchFile, pch->context());
@@ -300,14 +479,61 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
     }
 
     if (abortRequested()) {
+        discardTokenHighlighting();
         return;
     }
 
-    auto context = ClangHelpers::buildDUChain(session.mainFile(), imports, session,
-                                              minimumFeatures(), includedFiles, clang()->index());
+    // a header that changed on disk affects all translation units that include it, not only the one it is pinned to
+    uint previousFingerprint = 0;
+    const bool headerChanged = document() != m_environment.translationUnitUrl() && !m_unsavedRevisions.contains(document())
+                               && changedOnDisk(document(), &previousFingerprint);
+
+    const bool mainFileFirst = buildMainFileFirst();
+    auto context = mainFileFirst
+        ? ClangHelpers::buildMainFileDUChain(session.mainFile(), imports, session,
+                                             minimumFeatures(), includedFiles, clang()->index())
+        : ClangHelpers::buildDUChain(session.mainFile(), imports, session,
+                                     minimumFeatures(), includedFiles, clang()->index());
     setDuChain(context);
 
+    const bool deferredImports = mainFileFirst && context
+        && std::find(includedFiles.begin(), includedFiles.end(), ReferencedTopDUContext()) != includedFiles.end();
+    if (deferredImports) {
+        // build the skipped imports and then the main file again, to resolve its uses of their declarations
+        auto features = static_cast<TopDUContext::Features>(minimumFeatures() | TopDUContext::ForceUpdate | BuildDeferredImports);
+        ICore::self()->languageController()->backgroundParser()->addDocument(document(), features, BackgroundParser::NormalPriority);
+    } else if (context) {
+        QVector<IndexedString> files;
+        {
+            DUChainReadLocker lock;
+            files.reserve(includedFiles.size());
+            for (auto it = includedFiles.constBegin(); it != includedFiles.constEnd(); ++it) {
+                // system headers hardly ever change, tracking them would bloat the index of every translation unit
+                if (it.value() && it.value() != context
+                    && !clang_Location_isInSystemHeader(clang_getLocationForOffset(session.unit(), it.key(), 0)))
+                {
+                    files.append(it.value()->url());
+                }
+            }
+        }
+        clang()->index()->setIncludedFiles(m_environment.translationUnitUrl(), files);
+    }
+
+    if (context && headerChanged) {
+        const auto fingerprint = contentFingerprint(document());
+        if (!fingerprint || fingerprint != previousFingerprint) {
+            clang()->scheduleDependentTranslationUnits(document(), m_environment.translationUnitUrl());
+        }
+    }
+
+    if (context && !m_environment.pchInclude().isValid() && !m_unsavedRevisions.contains(m_environment.translationUnitUrl())) {
+        const auto& tuUrl = m_environment.translationUnitUrl();
+        clang()->index()->sharedPreambles()->addTranslationUnit(m_environment.hash(), tuUrl,
+                                                                shareableLeadingIncludes(session, imports, leadingContents(tuUrl, m_unsavedFiles)));
+    }
+
     if (abortRequested()) {
+        discardTokenHighlighting();
         return;
     }
 
@@ -353,14 +579,69 @@ void ClangParseJob::run(ThreadWeaver::JobPointer /*self*/, ThreadWeaver::Thread*
                 DUChainWriteLocker lock;
                 context->setAst(IAstContainer::Ptr(session.data()));
             }
+            ClangTrace::Scope highlightTrace("highlightDUChain", context->url());
             languageSupport()->codeHighlighting()->highlightDUChain(context);
+            if (context->url() == document()) {
+                // the DUChain highlighting clears the token highlighting
+                tokensHighlighted = false;
+            }
         }
     }
+
+    discardTokenHighlighting();
+}
+
+bool ClangParseJob::buildMainFileFirst() const
+{
+    // opt-in for now, as every document that gets opened without up-to-date headers is built twice
+    static const bool enabled = qEnvironmentVariableIsSet("KDEV_CLANG_MAIN_FILE_FIRST");
+    return enabled && !(minimumFeatures() & BuildDeferredImports)
+        && document() == m_environment.translationUnitUrl() && trackerForUrl(document());
 }
 
-ParseSessionData::Ptr ClangParseJob::createSessionData() const
+ParseSessionData::Ptr ClangParseJob::createSessionData(ParseSessionData::Options options) const
 {
-    return ParseSessionData::Ptr(new ParseSessionData(m_unsavedFiles, clang()->index(), m_environment, ParseSessionData::NoOption));
+    return ParseSessionData::Ptr(new ParseSessionData(m_unsavedFiles, clang()->index(), m_environment, options));
+}
+
+bool ClangParseJob::canSkipFunctionBodies() const
+{
+    // without bodies, the local declarations and contexts of functions are missing
+    const auto features = minimumFeatures();
+    if ((features & TopDUContext::AllDeclarationsAndContexts) == TopDUContext::AllDeclarationsAndContexts
+        || (features & TopDUContext::AST) || (features & AttachASTWithoutUpdating) || (features & UpdateHighlighting))
+    {
+        return false;
+    }
+
+    const auto tuUrl = m_environment.translationUnitUrl();
+    auto backgroundParser = ICore::self()->languageController()->backgroundParser();
+    const auto openDocuments = backgroundParser->managedDocuments();
+    if (openDocuments.isEmpty()) {
+        return true;
+    }
+
+    foreach (const auto& url, openDocuments) {
+        if (url == document() || url == tuUrl || clang()->index()->translationUnitForUrl(url) == tuUrl) {
+            return false;
+        }
+    }
+
+    // also check the files included by this TU the last time it got parsed
+    DUChainReadLocker lock;
+    auto top = DUChain::self()->chainForDocument(tuUrl, &m_environment);
+    if (!top) {
+        return true;
+    }
+    const auto recursiveImports = top->recursiveImportIndices();
+    auto iterator = recursiveImports.iterator();
+    while (iterator) {
+        if (openDocuments.contains((*iterator).url())) {
+            return false;
+        }
+        ++iterator;
+    }
+    return true;
 }
 
 const ParsingEnvironment* ClangParseJob::environment() const
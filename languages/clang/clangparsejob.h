@@ -25,12 +25,14 @@
 
 #include <QHash>
 
+#include <KTextEditor/Range>
+
 #include <language/backgroundparser/parsejob.h>
 #include "duchain/clangparsingenvironment.h"
+#include "duchain/parsesession.h"
 #include "duchain/unsavedfile.h"
 
 class ClangSupport;
-class ParseSessionData;
 
 class ClangParseJob : public KDevelop::ParseJob
 {
@@ -43,7 +45,9 @@ public:
     enum CustomFeatures {
         Rescheduled = (KDevelop::TopDUContext::LastFeature << 1),
         AttachASTWithoutUpdating = (Rescheduled << 1), ///< Used when context is up to date, but has no AST attached.
-        UpdateHighlighting = (AttachASTWithoutUpdating << 1) ///< Used when we only need to update highlighting
+        UpdateHighlighting = (AttachASTWithoutUpdating << 1), ///< Used when we only need to update highlighting
+        BuildDeferredImports = (UpdateHighlighting << 1), ///< Used to build the imports skipped by a main-file-first build
+        SkipTranslationUnitCache = (BuildDeferredImports << 1) ///< Used to attach a freshly parsed AST instead of a saved one
     };
 
 protected:
@@ -52,11 +56,25 @@ protected:
     virtual const KDevelop::ParsingEnvironment* environment() const override;
 
 private:
-    QExplicitlySharedDataPointer<ParseSessionData> createSessionData() const;
+    QExplicitlySharedDataPointer<ParseSessionData> createSessionData(ParseSessionData::Options options = ParseSessionData::NoOption) const;
+
+    /**
+     * @return true when the TU can be parsed without function bodies, i.e. when only the visible declarations
+     * and contexts are required and neither the TU nor any of its files are opened in the editor
+     */
+    bool canSkipFunctionBodies() const;
+
+    /**
+     * @return true when only the DUChain of the main file should be built, deferring its imports to a follow-up job
+     */
+    bool buildMainFileFirst() const;
 
     ClangParsingEnvironment m_environment;
     QVector<UnsavedFile> m_unsavedFiles;
     QHash<KDevelop::IndexedString, KDevelop::ModificationRevision> m_unsavedRevisions;
+    /// The lines of the open document that get highlighted before its DUChain is built
+    KTextEditor::Range m_tokenHighlightingRange = KTextEditor::Range::invalid();
+    qint64 m_tokenHighlightingRevision = -1;
 };
 
 #endif // CLANGPARSEJOB_H
@@ -39,15 +39,20 @@
 #include <interfaces/iplugincontroller.h>
 #include <interfaces/contextmenuextension.h>
 #include <interfaces/idocumentcontroller.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iprojectcontroller.h>
+#include <interfaces/isession.h>
 #include <language/interfaces/iastcontainer.h>
 
 #include "codegen/adaptsignatureassistant.h"
+#include "duchain/clanghelpers.h"
 #include "duchain/documentfinderhelpers.h"
 #include "duchain/clangindex.h"
 #include "duchain/navigationwidget.h"
 #include "duchain/macrodefinition.h"
 #include "duchain/clangparsingenvironmentfile.h"
 #include "duchain/duchainutils.h"
+#include "duchain/translationunittrimmer.h"
 
 #include <language/assistant/staticassistantsmanager.h>
 #include <language/assistant/renameassistant.h>
@@ -62,6 +67,7 @@
 #include <language/duchain/parsingenvironment.h>
 #include <language/duchain/use.h>
 #include <language/editor/documentcursor.h>
+#include <project/projectmodel.h>
 
 #include "clangsettings/sessionsettings/sessionsettings.h"
 
@@ -186,6 +192,11 @@ ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
     m_highlighting = new ClangHighlighting(this);
     m_refactoring = new BasicRefactoring(this);
     m_index.reset(new ClangIndex);
+    if (auto session = core()->activeSession()) {
+        // remember the pinned translation units across restarts of this session
+        const Path dataArea(session->pluginDataArea(this));
+        m_index->setPinStoragePath(Path(dataArea, QStringLiteral("pinnedtranslationunits")).toLocalFile());
+    }
 
     auto model = new KDevelop::CodeCompletion( this, new ClangCodeCompletionModel(m_index.data(), this), name() );
     // TODO: use direct signal/slot connect syntax for 5.1
@@ -203,6 +214,23 @@ ClangSupport::ClangSupport(QObject* parent, const QVariantList& )
 
     connect(ICore::self()->documentController(), &IDocumentController::documentActivated,
             this, &ClangSupport::documentActivated);
+    connect(ICore::self()->documentController(), &IDocumentController::documentClosed,
+            this, &ClangSupport::documentClosed);
+    connect(ICore::self()->documentController(), &IDocumentController::documentSaved,
+            this, &ClangSupport::documentSaved);
+
+    // disposed translation units get attached again in documentActivated
+    new TranslationUnitTrimmer(this);
+
+    // keep the buddy file index in sync with the project files
+    auto projectController = core()->projectController();
+    connect(projectController, &IProjectController::projectOpened,
+            this, &ClangSupport::projectOpened);
+    connect(projectController, &IProjectController::projectClosing,
+            this, &ClangSupport::projectClosing);
+    foreach (auto project, projectController->projects()) {
+        projectOpened(project);
+    }
 }
 
 ClangSupport::~ClangSupport()
@@ -253,9 +281,14 @@ ClangIndex* ClangSupport::index()
     return m_index.data();
 }
 
+ClangHighlighting* ClangSupport::highlighting() const
+{
+    return m_highlighting;
+}
+
 bool ClangSupport::areBuddies(const QUrl &url1, const QUrl& url2)
 {
-    return DocumentFinderHelpers::areBuddies(url1, url2);
+    return DocumentFinderHelpers::areBuddies(url1, url2, m_index->buddyFileIndex());
 }
 
 bool ClangSupport::buddyOrder(const QUrl &url1, const QUrl& url2)
@@ -265,7 +298,7 @@ bool ClangSupport::buddyOrder(const QUrl &url1, const QUrl& url2)
 
 QVector< QUrl > ClangSupport::getPotentialBuddies(const QUrl &url) const
 {
-    return DocumentFinderHelpers::getPotentialBuddies(url);
+    return DocumentFinderHelpers::getPotentialBuddies(url, m_index->buddyFileIndex());
 }
 
 void ClangSupport::createActionsForMainWindow (Sublime::MainWindow* /*window*/, QString& _xmlFile, KActionCollection& actions)
@@ -393,6 +426,83 @@ void ClangSupport::documentActivated(IDocument* doc)
     ICore::self()->languageController()->backgroundParser()->addDocument(indexedUrl, features);
 }
 
+void ClangSupport::documentClosed(IDocument* doc)
+{
+    auto cache = index()->translationUnitCache();
+    if (!cache->isEnabled()) {
+        return;
+    }
+
+    // save the unit, such that it can be attached again quickly when the document gets reopened
+    const auto indexedUrl = IndexedString(doc->url());
+    if (auto sessionData = ClangIntegration::DUChainUtils::findParseSessionData(indexedUrl, index()->translationUnitForUrl(indexedUrl))) {
+        cache->save(sessionData);
+    }
+}
+
+void ClangSupport::documentSaved(IDocument* doc)
+{
+    const auto indexedUrl = IndexedString(doc->url());
+    if (!ClangHelpers::isHeader(indexedUrl.str())) {
+        return;
+    }
+
+    // the edits of an open header were only parsed through its pinned translation unit,
+    // now that they are on disk the other translation units including it must see them too
+    scheduleDependentTranslationUnits(indexedUrl, index()->translationUnitForUrl(indexedUrl));
+}
+
+void ClangSupport::scheduleDependentTranslationUnits(const IndexedString& file, const IndexedString& parsedTranslationUnit)
+{
+    auto backgroundParser = ICore::self()->languageController()->backgroundParser();
+    foreach (const auto& tu, index()->dependentTranslationUnits(file)) {
+        if (tu == parsedTranslationUnit) {
+            continue;
+        }
+        // open documents first, those need all uses
+        const bool open = backgroundParser->trackerForUrl(tu);
+        const auto features = static_cast<TopDUContext::Features>(TopDUContext::ForceUpdate |
+            (open ? TopDUContext::AllDeclarationsContextsAndUses : TopDUContext::VisibleDeclarationsAndContexts));
+        backgroundParser->addDocument(tu, features, open ? BackgroundParser::NormalPriority : BackgroundParser::InitialParsePriority);
+    }
+}
+
+static QStringList localFiles(const QSet<IndexedString>& files)
+{
+    QStringList paths;
+    paths.reserve(files.size());
+    foreach (const auto& file, files) {
+        paths.append(file.str());
+    }
+    return paths;
+}
+
+void ClangSupport::projectOpened(IProject* project)
+{
+    m_index->buddyFileIndex()->addFiles(localFiles(project->fileSet()));
+    // TODO: use direct signal/slot connect syntax for 5.1
+    connect(project, SIGNAL(fileAddedToSet(KDevelop::ProjectFileItem*)),
+            this, SLOT(fileAddedToSet(KDevelop::ProjectFileItem*)), Qt::UniqueConnection);
+    connect(project, SIGNAL(fileRemovedFromSet(KDevelop::ProjectFileItem*)),
+            this, SLOT(fileRemovedFromSet(KDevelop::ProjectFileItem*)), Qt::UniqueConnection);
+}
+
+void ClangSupport::projectClosing(IProject* project)
+{
+    disconnect(project, nullptr, this, nullptr);
+    m_index->buddyFileIndex()->removeFiles(localFiles(project->fileSet()));
+}
+
+void ClangSupport::fileAddedToSet(ProjectFileItem* file)
+{
+    m_index->buddyFileIndex()->addFiles({file->indexedPath().str()});
+}
+
+void ClangSupport::fileRemovedFromSet(ProjectFileItem* file)
+{
+    m_index->buddyFileIndex()->removeFiles({file->indexedPath().str()});
+}
+
 static void setKeywordCompletion(KTextEditor::View* view, bool enabled)
 {
     if (auto config = qobject_cast<KTextEditor::ConfigInterface*>(view)) {
@@ -32,10 +32,13 @@
 #include <QVariantList>
 
 class ClangIndex;
+class ClangHighlighting;
 namespace KDevelop
 {
 class BasicRefactoring;
 class IDocument;
+class IProject;
+class ProjectFileItem;
 }
 
 namespace KTextEditor
@@ -71,6 +74,16 @@ public:
 
     ClangIndex* index();
 
+    ClangHighlighting* highlighting() const;
+
+    /**
+     * Reparse the translation units that include @p file, after its contents changed on disk
+     *
+     * @p parsedTranslationUnit is skipped, since it already saw the new contents.
+     */
+    void scheduleDependentTranslationUnits(const KDevelop::IndexedString& file,
+                                           const KDevelop::IndexedString& parsedTranslationUnit);
+
     KDevelop::TopDUContext* standardContext(const QUrl &url, bool proxyContext = false) override;
 
     KDevelop::ConfigPage* configPage(int number, QWidget *parent) override;
@@ -87,11 +100,17 @@ public:
 
 private slots:
     void documentActivated(KDevelop::IDocument* doc);
+    void documentClosed(KDevelop::IDocument* doc);
+    void documentSaved(KDevelop::IDocument* doc);
+    void projectOpened(KDevelop::IProject* project);
+    void projectClosing(KDevelop::IProject* project);
+    void fileAddedToSet(KDevelop::ProjectFileItem* file);
+    void fileRemovedFromSet(KDevelop::ProjectFileItem* file);
     void disableKeywordCompletion(KTextEditor::View* view);
     void enableKeywordCompletion(KTextEditor::View* view);
 
 private:
-    KDevelop::ICodeHighlighting *m_highlighting;
+    ClangHighlighting *m_highlighting;
     KDevelop::BasicRefactoring *m_refactoring;
     QScopedPointer<ClangIndex> m_index;
 };
@@ -322,7 +322,8 @@ CompletionHelper::CompletionHelper()
 {
 }
 
-void CompletionHelper::computeCompletions(const ParseSession& session, CXFile file, const KTextEditor::Cursor& position)
+void CompletionHelper::computeCompletions(const ParseSession& session, CXFile file, const KTextEditor::Cursor& position,
+                                          const BuddyFileIndex* buddyFileIndex)
 {
     const auto unit = session.unit();
 
@@ -359,7 +360,8 @@ void CompletionHelper::computeCompletions(const ParseSession& session, CXFile fi
 
         QVector<CXFile> fileFilter;
         fileFilter << file;
-        const auto& buddies = DocumentFinderHelpers::getPotentialBuddies(QUrl::fromLocalFile(ClangString(clang_getFileName(file)).toString()));
+        const auto& buddies = DocumentFinderHelpers::getPotentialBuddies(QUrl::fromLocalFile(ClangString(clang_getFileName(file)).toString()),
+                                                                         buddyFileIndex);
         foreach(const auto& buddy, buddies) {
             auto buddyFile = clang_getFile(unit, qPrintable(buddy.toLocalFile()));
             if (buddyFile) {
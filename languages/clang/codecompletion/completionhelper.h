@@ -52,6 +52,7 @@ namespace KTextEditor {
 class Cursor;
 }
 
+class BuddyFileIndex;
 class ParseSession;
 
 Q_DECLARE_TYPEINFO(FuncOverrideInfo, Q_MOVABLE_TYPE);
@@ -64,8 +65,12 @@ class CompletionHelper
 public:
     CompletionHelper();
 
+    /**
+     * Compute the overrides and implementations available at @p position,
+     * the implementations are looked up in @p file and its buddies from @p buddyFileIndex
+     */
     void computeCompletions(const ParseSession& session, CXFile file,
-                            const KTextEditor::Cursor& position);
+                            const KTextEditor::Cursor& position, const BuddyFileIndex* buddyFileIndex = nullptr);
 
     FunctionOverrideList overrides() const;
     FunctionImplementsList implements() const;
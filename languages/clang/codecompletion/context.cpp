@@ -48,10 +48,13 @@
 #include "../util/clangdebug.h"
 #include "../util/clangtypes.h"
 #include "../duchain/clangdiagnosticevaluator.h"
+#include "../duchain/clangindex.h"
+#include "../duchain/clangpch.h"
 #include "../duchain/parsesession.h"
 #include "../duchain/navigationwidget.h"
 #include "../clangsettings/clangsettingsmanager.h"
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 
@@ -736,6 +739,33 @@ public slots:
 };
 static MemberAccessReplacer s_memberAccessReplacer;
 
+/**
+ * @return the unsaved files for clang_codeCompleteAt: @p contents for @p file and the other modified documents,
+ *         such that clang sees the same contents the translation unit was parsed with
+ *
+ * NOTE: The returned data points into @p otherFiles and @p contents
+ */
+QVector<CXUnsavedFile> unsavedFilesForCompletion(const QVector<UnsavedFile>& otherFiles,
+                                                 const QByteArray& file, const QByteArray& contents)
+{
+    QVector<CXUnsavedFile> unsaved;
+    unsaved.reserve(otherFiles.size() + 1);
+    for (const auto& otherFile : otherFiles) {
+        const auto clangFile = otherFile.toClangApi();
+        if (file != clangFile.Filename) {
+            unsaved.append(clangFile);
+        }
+    }
+    if (!contents.isEmpty()) {
+        CXUnsavedFile current;
+        current.Filename = file.constData();
+        current.Contents = contents.constData();
+        current.Length = contents.size() + 1; // + \0-byte
+        unsaved.append(current);
+    }
+    return unsaved;
+}
+
 }
 
 Q_DECLARE_METATYPE(MemberAccessReplacer::Type)
@@ -745,7 +775,8 @@ ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& c
                                                        const QUrl& url,
                                                        const KTextEditor::Cursor& position,
                                                        const QString& text,
-                                                       const QString& followingText
+                                                       const QString& followingText,
+                                                       ClangIndex* index
                                                       )
     : CodeCompletionContext(context, text + followingText, CursorInRevision::castFromSimpleCursor(position), 0)
     , m_results(nullptr, clang_disposeCodeCompleteResults)
@@ -753,19 +784,27 @@ ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& c
 {
     qRegisterMetaType<MemberAccessReplacer::Type>();
     const QByteArray file = url.toLocalFile().toUtf8();
+    // the other modified documents are shared with the parse jobs, only this document gets encoded here
+    auto otherUnsavedFiles = index ? index->unsavedFileCache()->unsavedFiles() : QVector<UnsavedFile>();
     ParseSession session(m_parseSessionData);
+    if (!session.pchFile().isEmpty()) {
+        // clang rejects the precompiled header when one of its files is overridden,
+        // the unit still sees the contents they were precompiled with
+        if (const auto pch = session.pch()) {
+            otherUnsavedFiles.erase(std::remove_if(otherUnsavedFiles.begin(), otherUnsavedFiles.end(),
+                                                   [&pch] (const UnsavedFile& file) { return pch->dependsOn(file); }),
+                                    otherUnsavedFiles.end());
+        }
+    }
     {
         const unsigned int completeOptions = clang_defaultCodeCompleteOptions();
 
-        CXUnsavedFile unsaved;
-        unsaved.Filename = file.constData();
         const QByteArray content = m_text.toUtf8();
-        unsaved.Contents = content.constData();
-        unsaved.Length = content.size() + 1; // + \0-byte
+        auto unsaved = unsavedFilesForCompletion(otherUnsavedFiles, file, content);
 
         m_results.reset(clang_codeCompleteAt(session.unit(), file.constData(),
                         position.line() + 1, position.column() + 1,
-                        content.isEmpty() ? nullptr : &unsaved, content.isEmpty() ? 0 : 1,
+                        unsaved.isEmpty() ? nullptr : unsaved.data(), unsaved.size(),
                         completeOptions));
 
         if (!m_results) {
@@ -808,15 +847,12 @@ ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& c
             m_text = trimmedText.left(trimmedText.size() - 1);
             m_text += QStringLiteral("->");
 
-            CXUnsavedFile unsaved;
-            unsaved.Filename = file.constData();
             const QByteArray content = m_text.toUtf8();
-            unsaved.Contents = content.constData();
-            unsaved.Length = content.size() + 1;
+            auto unsaved = unsavedFilesForCompletion(otherUnsavedFiles, file, content);
 
             m_results.reset(clang_codeCompleteAt(session.unit(), file.constData(),
                                                  position.line() + 1, position.column() + 1 + 1,
-                                                 &unsaved, 1,
+                                                 unsaved.isEmpty() ? nullptr : unsaved.data(), unsaved.size(),
                                                  clang_defaultCodeCompleteOptions()));
 
             if (m_results && m_results->NumResults) {
@@ -836,7 +872,7 @@ ClangCodeCompletionContext::ClangCodeCompletionContext(const DUContextPointer& c
         return;
     }
 
-    m_completionHelper.computeCompletions(session, clangFile, position);
+    m_completionHelper.computeCompletions(session, clangFile, position, index ? index->buddyFileIndex() : nullptr);
 }
 
 ClangCodeCompletionContext::~ClangCodeCompletionContext()
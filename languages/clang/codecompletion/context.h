@@ -33,6 +33,8 @@
 #include "completionhelper.h"
 #include "clangprivateexport.h"
 
+class ClangIndex;
+
 class KDEVCLANGPRIVATE_EXPORT ClangCodeCompletionContext : public KDevelop::CodeCompletionContext
 {
 public:
@@ -46,12 +48,17 @@ public:
     };
     Q_DECLARE_FLAGS(ContextFilters, ContextFilter)
 
+    /**
+     * The other modified documents and the buddies of the completed document are looked up in @p index,
+     * without an index only the contents of the completed document are passed to clang.
+     */
     ClangCodeCompletionContext(const KDevelop::DUContextPointer& context,
                                const ParseSessionData::Ptr& sessionData,
                                const QUrl& url,
                                const KTextEditor::Cursor& position,
                                const QString& text,
-                               const QString& followingText = {});
+                               const QString& followingText = {},
+                               ClangIndex* index = nullptr);
     ~ClangCodeCompletionContext();
 
     virtual QList<KDevelop::CompletionTreeItemPointer> completionItems(bool& abort, bool fullCompletion = true) override;
@@ -0,0 +1,165 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "includedirectoryindex.h"
+
+#include "duchain/clanghelpers.h"
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+namespace {
+
+/// file watchers are a limited resource, directories beyond this limit are validated by their modification time
+const int maxWatchedDirectories = 512;
+
+QVector<IncludeDirectoryIndex::Entry> listDirectory(const QString& directory)
+{
+    QVector<IncludeDirectoryIndex::Entry> entries;
+
+    QDirIterator dirIterator(directory);
+    while (dirIterator.hasNext()) {
+        dirIterator.next();
+        const QString name = dirIterator.fileName();
+
+        if (name.startsWith(QLatin1Char('.')) || name.endsWith(QLatin1Char('~'))) { //filter out ".", "..", hidden files, and backups
+            continue;
+        }
+
+        const auto info = dirIterator.fileInfo();
+        const bool isDirectory = info.isDir();
+
+        // filter files that are not a header
+        // note: system headers sometimes don't have any extension, and we still want to show those
+        if (!isDirectory && name.contains(QLatin1Char('.')) && !ClangHelpers::isHeader(name)) {
+            continue;
+        }
+
+        entries.append({name, info.canonicalFilePath(), isDirectory});
+    }
+
+    std::sort(entries.begin(), entries.end(), [] (const IncludeDirectoryIndex::Entry& lhs, const IncludeDirectoryIndex::Entry& rhs) {
+        return lhs.name < rhs.name;
+    });
+    return entries;
+}
+
+}
+
+IncludeDirectoryIndex::IncludeDirectoryIndex(QObject* parent)
+    : QObject(parent)
+    , m_watcher(new QFileSystemWatcher(this))
+{
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged,
+            this, &IncludeDirectoryIndex::directoryChanged);
+
+    if (!parent) {
+        // completion runs in a background thread, but the watcher must be used from the main thread
+        moveToThread(QCoreApplication::instance()->thread());
+    }
+}
+
+IncludeDirectoryIndex::~IncludeDirectoryIndex() = default;
+
+QVector<IncludeDirectoryIndex::Entry> IncludeDirectoryIndex::entries(const QString& directory)
+{
+    Directory cached;
+    bool found = false;
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_directories.constFind(directory);
+        if (it != m_directories.constEnd()) {
+            cached = *it;
+            found = true;
+        }
+    }
+
+    QDateTime lastModified;
+    if (!found || !cached.watched) {
+        lastModified = QFileInfo(directory).lastModified();
+    }
+
+    if (found && (cached.watched || cached.lastModified == lastModified)) {
+        QMutexLocker lock(&m_mutex);
+        ++m_statistics.hits;
+        return cached.entries;
+    }
+
+    Directory listed;
+    listed.lastModified = lastModified;
+    listed.entries = listDirectory(directory);
+
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_statistics.misses;
+        m_directories.insert(directory, listed);
+    }
+
+    if (lastModified.isValid()) {
+        QMetaObject::invokeMethod(this, "watchDirectory", Qt::QueuedConnection, Q_ARG(QString, directory));
+    }
+
+    return listed.entries;
+}
+
+IncludeDirectoryIndex::Statistics IncludeDirectoryIndex::statistics() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_statistics;
+}
+
+void IncludeDirectoryIndex::clear()
+{
+    QMutexLocker lock(&m_mutex);
+    m_directories.clear();
+}
+
+void IncludeDirectoryIndex::watchDirectory(const QString& directory)
+{
+    const bool watching = m_watcher->directories().contains(directory);
+    if (!watching && (m_watcher->directories().size() >= maxWatchedDirectories || !m_watcher->addPath(directory))) {
+        return;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    auto it = m_directories.find(directory);
+    if (it != m_directories.end()) {
+        // the directory could have changed before the watcher got installed, so only trust the
+        // listing when it still matches the modification time
+        if (it->lastModified == QFileInfo(directory).lastModified()) {
+            it->watched = true;
+        } else {
+            m_directories.erase(it);
+        }
+    }
+}
+
+void IncludeDirectoryIndex::directoryChanged(const QString& directory)
+{
+    m_watcher->removePath(directory);
+
+    QMutexLocker lock(&m_mutex);
+    m_directories.remove(directory);
+}
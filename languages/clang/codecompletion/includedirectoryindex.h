@@ -0,0 +1,100 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef INCLUDEDIRECTORYINDEX_H
+#define INCLUDEDIRECTORYINDEX_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include "clangprivateexport.h"
+
+class QFileSystemWatcher;
+
+/**
+ * Cache of the contents of include directories, for #include completion.
+ *
+ * Listing directories is expensive on slow file systems, so the listings are reused by
+ * all completion requests. Watched directories are dropped when they change, all others
+ * are validated against the modification time of the directory.
+ *
+ * The index of the clang plugin is owned by its ClangCodeCompletionModel.
+ */
+class KDEVCLANGPRIVATE_EXPORT IncludeDirectoryIndex : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry
+    {
+        QString name;
+        /// used to filter out entries that are found multiple times
+        QString canonicalPath;
+        bool isDirectory;
+    };
+
+    struct Statistics
+    {
+        uint hits = 0;
+        uint misses = 0;
+    };
+
+    explicit IncludeDirectoryIndex(QObject* parent = nullptr);
+    ~IncludeDirectoryIndex() override;
+
+    /**
+     * @return the subdirectories and headers in @p directory, sorted by name
+     *
+     * Hidden files, backups and files with an extension that is not a header extension are skipped.
+     *
+     * NOTE: This is thread safe.
+     */
+    QVector<Entry> entries(const QString& directory);
+
+    Statistics statistics() const;
+
+    /**
+     * Drop all cached listings
+     */
+    void clear();
+
+private slots:
+    void watchDirectory(const QString& directory);
+    void directoryChanged(const QString& directory);
+
+private:
+    struct Directory
+    {
+        QDateTime lastModified;
+        bool watched = false;
+        QVector<Entry> entries;
+    };
+
+    mutable QMutex m_mutex;
+    QHash<QString, Directory> m_directories;
+    Statistics m_statistics;
+    QFileSystemWatcher* m_watcher;
+};
+
+Q_DECLARE_TYPEINFO(IncludeDirectoryIndex::Entry, Q_MOVABLE_TYPE);
+
+#endif // INCLUDEDIRECTORYINDEX_H
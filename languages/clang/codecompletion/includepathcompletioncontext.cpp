@@ -23,11 +23,10 @@
 #include "includepathcompletioncontext.h"
 
 #include "duchain/navigationwidget.h"
-#include "duchain/clanghelpers.h"
+#include "includedirectoryindex.h"
 
 #include <language/codecompletion/abstractincludefilecompletionitem.h>
 
-#include <QDirIterator>
 #include <QRegularExpression>
 
 #include <KTextEditor/View>
@@ -159,7 +158,8 @@ IncludePathProperties includePathProperties(const QString& text, int rightBounda
     return properties;
 }
 
-QList<KDevelop::IncludeItem> includeItemsForUrl(const QUrl& url, const IncludePathProperties& properties, const Path::List& includePaths )
+QList<KDevelop::IncludeItem> includeItemsForUrl(const QUrl& url, const IncludePathProperties& properties, const Path::List& includePaths,
+                                                IncludeDirectoryIndex* directoryIndex)
 {
     QList<IncludeItem> includeItems;
     Path::List paths = includePaths;
@@ -178,32 +178,17 @@ QList<KDevelop::IncludeItem> includeItemsForUrl(const QUrl& url, const IncludePa
         }
 
         QSet<QString> foundIncludePaths;
-        QDirIterator dirIterator(searchPath.toLocalFile());
-        while (dirIterator.hasNext()) {
-            dirIterator.next();
-            KDevelop::IncludeItem item;
-            item.name = dirIterator.fileName();
-
-            if (item.name.startsWith(QLatin1Char('.')) || item.name.endsWith(QLatin1Char('~'))) { //filter out ".", "..", hidden files, and backups
-                continue;
-            }
-
-            const auto info = dirIterator.fileInfo();
-            item.isDirectory = info.isDir();
-
-            // filter files that are not a header
-            // note: system headers sometimes don't have any extension, and we still want to show those
-            if (!item.isDirectory && item.name.contains(QLatin1Char('.')) && !ClangHelpers::isHeader(item.name)) {
-                continue;
-            }
-
-            const QString fullPath = info.canonicalFilePath();
-            if (foundIncludePaths.contains(fullPath)) {
+        const auto entries = directoryIndex->entries(searchPath.toLocalFile());
+        for (const auto& entry : entries) {
+            if (foundIncludePaths.contains(entry.canonicalPath)) {
                 continue;
             } else {
-                foundIncludePaths.insert(fullPath);
+                foundIncludePaths.insert(entry.canonicalPath);
             }
 
+            KDevelop::IncludeItem item;
+            item.name = entry.name;
+            item.isDirectory = entry.isDirectory;
             item.basePath = searchPath.toUrl();
             item.pathNumber = pathNumber;
 
@@ -272,7 +257,8 @@ IncludePathCompletionContext::IncludePathCompletionContext(const DUContextPointe
                                                            const ParseSessionData::Ptr& sessionData,
                                                            const QUrl& url,
                                                            const KTextEditor::Cursor& position,
-                                                           const QString& text)
+                                                           const QString& text,
+                                                           IncludeDirectoryIndex* directoryIndex)
     : CodeCompletionContext(context, text, CursorInRevision::castFromSimpleCursor(position), 0)
 {
     const IncludePathProperties properties = includePathProperties(text);
@@ -281,7 +267,8 @@ IncludePathCompletionContext::IncludePathCompletionContext(const DUContextPointe
         return;
     }
 
-    m_includeItems = includeItemsForUrl(url, properties, properties.local ?  sessionData->environment().includes().project : sessionData->environment().includes().system);
+    m_includeItems = includeItemsForUrl(url, properties, properties.local ?  sessionData->environment().includes().project : sessionData->environment().includes().system,
+                                        directoryIndex);
 }
 
 QList< CompletionTreeItemPointer > IncludePathCompletionContext::completionItems(bool& abort, bool)
@@ -28,14 +28,20 @@
 #include <language/codecompletion/codecompletioncontext.h>
 #include <language/util/includeitem.h>
 
+class IncludeDirectoryIndex;
+
 class KDEVCLANGPRIVATE_EXPORT IncludePathCompletionContext : public KDevelop::CodeCompletionContext
 {
 public:
+    /**
+     * The include directories are listed via @p directoryIndex
+     */
     IncludePathCompletionContext(const KDevelop::DUContextPointer& context,
                                  const ParseSessionData::Ptr& sessionData,
                                  const QUrl& url,
                                  const KTextEditor::Cursor& position,
-                                 const QString& text);
+                                 const QString& text,
+                                 IncludeDirectoryIndex* directoryIndex);
 
     virtual QList<KDevelop::CompletionTreeItemPointer> completionItems(bool& abort, bool fullCompletion = true) override;
 
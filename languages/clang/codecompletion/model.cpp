@@ -23,6 +23,7 @@
 
 #include "util/clangdebug.h"
 #include "context.h"
+#include "includedirectoryindex.h"
 #include "includepathcompletioncontext.h"
 
 #include "duchain/parsesession.h"
@@ -33,7 +34,9 @@
 #include <language/duchain/topducontext.h>
 #include <language/duchain/duchainutils.h>
 #include <language/duchain/duchainlock.h>
+#include <language/duchain/parsingenvironment.h>
 
+#include <QMutex>
 #include <QRegularExpression>
 
 #include <KTextEditor/View>
@@ -71,12 +74,14 @@ QSharedPointer<CodeCompletionContext> createCompletionContext(const DUContextPoi
                                                               const QUrl& url,
                                                               const KTextEditor::Cursor& position,
                                                               const QString& text,
-                                                              const QString& followingText)
+                                                              const QString& followingText,
+                                                              ClangIndex* index,
+                                                              IncludeDirectoryIndex* includeDirectoryIndex)
 {
     if (includePathCompletionRequired(text)) {
-        return QSharedPointer<IncludePathCompletionContext>::create(context, session, url, position, text);
+        return QSharedPointer<IncludePathCompletionContext>::create(context, session, url, position, text, includeDirectoryIndex);
     } else {
-        return QSharedPointer<ClangCodeCompletionContext>::create(context, session, url, position, text, followingText);
+        return QSharedPointer<ClangCodeCompletionContext>::create(context, session, url, position, text, followingText, index);
     }
 }
 
@@ -84,16 +89,53 @@ class ClangCodeCompletionWorker : public CodeCompletionWorker
 {
     Q_OBJECT
 public:
-    ClangCodeCompletionWorker(ClangIndex* index, CodeCompletionModel* model)
+    ClangCodeCompletionWorker(ClangIndex* index, IncludeDirectoryIndex* includeDirectoryIndex, CodeCompletionModel* model)
         : CodeCompletionWorker(model)
         , m_index(index)
+        , m_includeDirectoryIndex(includeDirectoryIndex)
+        , m_pendingRequest()
     {}
     ~ClangCodeCompletionWorker() override = default;
 
-public slots:
+    /**
+     * Schedule completion for the given request, called from the thread emitting the request
+     *
+     * Only the newest request matters, hence a request that is still pending gets replaced
+     * and a running completion gets aborted. That way, fast typing doesn't build up a queue
+     * of outdated requests.
+     */
+    void scheduleCompletion(const QUrl &url, const KTextEditor::Cursor& position, const QString& text, const QString& followingText)
+    {
+        QMutexLocker lock(&m_requestMutex);
+        const bool scheduled = m_pendingRequest.pending;
+        m_pendingRequest = {url, position, text, followingText, true};
+        aborting() = true;
+        if (!scheduled) {
+            QMetaObject::invokeMethod(this, "processPendingRequest", Qt::QueuedConnection);
+        }
+    }
+
+private slots:
+    void processPendingRequest()
+    {
+        Request request;
+        {
+            QMutexLocker lock(&m_requestMutex);
+            request = m_pendingRequest;
+            m_pendingRequest = {};
+            aborting() = false;
+        }
+        if (request.pending) {
+            completionRequested(request.url, request.position, request.text, request.followingText);
+        }
+    }
+
+private:
     void completionRequested(const QUrl &url, const KTextEditor::Cursor& position, const QString& text, const QString& followingText)
     {
-        aborting() = false;
+        if (m_lastCompletion.url != url) {
+            m_lastCompletion = {};
+        }
 
         DUChainReadLocker lock;
         if (aborting()) {
@@ -120,10 +162,29 @@ public slots:
             return;
         }
 
+        const auto envFile = top->parsingEnvironmentFile();
+        const auto revision = envFile ? envFile->modificationRevision() : ModificationRevision();
+        if (!m_lastCompletion.items.isEmpty() && m_lastCompletion.url == url && m_lastCompletion.position == position
+            && m_lastCompletion.revision == revision && m_lastCompletion.text == text)
+        {
+            // Only the identifier at the completion position changed, e.g. the user typed more of it.
+            // Clang would report the same results, so reuse the items and let the completion widget filter them.
+            foundItems(m_lastCompletion.items, m_lastCompletion.ungrouped);
+            return;
+        }
+        m_lastCompletion = {};
+
         // We hold DUChain lock, and ask for ParseSession, but TUDUChain indirectly holds ParseSession lock.
         lock.unlock();
 
-        auto completionContext = ::createCompletionContext(DUContextPointer(top), sessionData, url, position, text, followingText);
+        auto completionContext = ::createCompletionContext(DUContextPointer(top), sessionData, url, position, text, followingText,
+                                                           m_index, m_includeDirectoryIndex);
+
+        // don't wait for the lock when a newer request is pending already
+        if (aborting()) {
+            failed();
+            return;
+        }
 
         lock.lock();
         if (aborting()) {
@@ -131,17 +192,28 @@ public slots:
             return;
         }
 
-        bool abort = false;
         // NOTE: cursor might be wrong here, but shouldn't matter much I hope...
         //       when the document changed significantly, then the cache is off anyways and we don't get anything sensible
         //       the position here is just a "optimization" to only search up to that position
-        const auto& items = completionContext->completionItems(abort);
+        //       the results are processed until a newer request aborts us
+        const auto& items = completionContext->completionItems(aborting());
 
         if (aborting()) {
             failed();
             return;
         }
 
+        const auto ungrouped = completionContext->ungroupedElements();
+        if (!items.isEmpty()) {
+            m_lastCompletion = {url, position, text, revision, items, ungrouped};
+        }
+
+        foundItems(items, ungrouped);
+    }
+
+    /// Group the @p items and pass them to the model along with the @p ungrouped elements, the DUChain must be locked
+    void foundItems(const QList<CompletionTreeItemPointer>& items, const QList<CompletionTreeElementPointer>& ungrouped)
+    {
         auto tree = computeGroups( items, {} );
 
         if (aborting()) {
@@ -149,18 +221,49 @@ public slots:
             return;
         }
 
-        tree += completionContext->ungroupedElements();
+        tree += ungrouped;
 
         foundDeclarations( tree, {} );
     }
-private:
+
+    /**
+     * The items of the last completion, reused when completion is requested again at the same position
+     *
+     * Only the items are kept, not the completion context, as that one holds on to the parse session
+     * and would keep the translation unit alive after its document got trimmed or closed.
+     */
+    struct LastCompletion
+    {
+        QUrl url;
+        KTextEditor::Cursor position;
+        QString text;
+        ModificationRevision revision;
+        QList<CompletionTreeItemPointer> items;
+        QList<CompletionTreeElementPointer> ungrouped;
+    };
+
+    struct Request
+    {
+        QUrl url;
+        KTextEditor::Cursor position;
+        QString text;
+        QString followingText;
+        bool pending;
+    };
+
     ClangIndex* m_index;
+    IncludeDirectoryIndex* m_includeDirectoryIndex;
+    LastCompletion m_lastCompletion;
+    QMutex m_requestMutex;
+    /// The newest request that was not processed yet
+    Request m_pendingRequest;
 };
 }
 
 ClangCodeCompletionModel::ClangCodeCompletionModel(ClangIndex* index, QObject* parent)
     : CodeCompletionModel(parent)
     , m_index(index)
+    , m_includeDirectoryIndex(new IncludeDirectoryIndex(this))
 {
     qRegisterMetaType<KTextEditor::Cursor>();
 }
@@ -183,9 +286,10 @@ bool ClangCodeCompletionModel::shouldStartCompletion(KTextEditor::View* view, co
 
 CodeCompletionWorker* ClangCodeCompletionModel::createCompletionWorker()
 {
-    auto worker = new ClangCodeCompletionWorker(m_index, this);
+    auto worker = new ClangCodeCompletionWorker(m_index, m_includeDirectoryIndex, this);
+    // the worker coalesces the requests itself, see ClangCodeCompletionWorker::scheduleCompletion
     connect(this, &ClangCodeCompletionModel::requestCompletion,
-            worker, &ClangCodeCompletionWorker::completionRequested);
+            worker, &ClangCodeCompletionWorker::scheduleCompletion, Qt::DirectConnection);
     return worker;
 }
 
@@ -34,6 +34,7 @@ Q_DECLARE_METATYPE(KTextEditor::Cursor)
 #endif
 
 class ClangIndex;
+class IncludeDirectoryIndex;
 
 class KDEVCLANGPRIVATE_EXPORT ClangCodeCompletionModel : public KDevelop::CodeCompletionModel
 {
@@ -57,6 +58,9 @@ protected:
 
 private:
     ClangIndex* m_index;
+    /// the listings of include directories, shared by all #include completion requests.
+    /// A child, so that it's deleted only after the base class stopped the completion worker
+    IncludeDirectoryIndex* m_includeDirectoryIndex;
 };
 
 #endif // CLANGCODECOMPLETIONMODEL_H
@@ -22,6 +22,7 @@
 #include <interfaces/icore.h>
 #include <interfaces/ilanguagecontroller.h>
 #include <language/assistant/renameaction.h>
+#include <language/backgroundparser/backgroundparser.h>
 #include <language/duchain/duchainutils.h>
 #include <language/duchain/functiondefinition.h>
 #include <language/duchain/classfunctiondeclaration.h>
@@ -30,11 +31,34 @@
 #include <KTextEditor/Document>
 #include <KTextEditor/View>
 
+#include <QCoreApplication>
+#include <QRunnable>
+
 #include "../util/clangdebug.h"
 
 using namespace KDevelop;
 
 namespace {
+/// delay in milliseconds before the other side gets updated after the last edit
+const int otherSideUpdateDelay = 500;
+
+class FunctionJob : public QRunnable
+{
+public:
+    explicit FunctionJob(const std::function<void()>& function)
+        : m_function(function)
+    {
+    }
+
+    void run() override
+    {
+        m_function();
+    }
+
+private:
+    std::function<void()> m_function;
+};
+
 Declaration *getDeclarationAtCursor(const KTextEditor::Cursor &cursor, const QUrl &documentUrl)
 {
     ENSURE_CHAIN_READ_LOCKED
@@ -77,11 +101,27 @@ Signature getDeclarationSignature(const Declaration *functionDecl, const DUConte
 
 AdaptSignatureAssistant::AdaptSignatureAssistant(ILanguageSupport* supportedLanguage)
     : StaticAssistant(supportedLanguage)
+    , m_pendingSnapshot(-1, {})
+    , m_pendingChanges(-1, {})
 {
+    // a single thread handles the jobs in the order of the edits
+    m_jobPool.setMaxThreadCount(1);
+
+    m_otherSideUpdateTimer.setSingleShot(true);
+    m_otherSideUpdateTimer.setInterval(otherSideUpdateDelay);
+    connect(&m_otherSideUpdateTimer, &QTimer::timeout,
+            this, &AdaptSignatureAssistant::updateOtherSide);
+
     connect(DUChain::self(), &DUChain::updateReady,
             this, &AdaptSignatureAssistant::updateReady);
 }
 
+AdaptSignatureAssistant::~AdaptSignatureAssistant()
+{
+    // the jobs access this assistant
+    m_jobPool.waitForDone();
+}
+
 QString AdaptSignatureAssistant::title() const
 {
     return tr("Adapt Signature");
@@ -92,12 +132,9 @@ void AdaptSignatureAssistant::reset()
     doHide();
     clearActions();
 
-    m_editingDefinition = {};
-    m_declarationName = {};
-    m_otherSideId = DeclarationId();
-    m_otherSideTopContext = {};
-    m_otherSideContext = {};
-    m_oldSignature = {};
+    ++m_generation;
+    m_documentUpdated = false;
+    m_snapshot = {};
     m_document = {};
     m_view.clear();
 }
@@ -114,15 +151,42 @@ void AdaptSignatureAssistant::textChanged(KTextEditor::View* view, const KTextEd
     }
     m_document = view->document()->url();
 
-    DUChainReadLocker lock(DUChain::lock(), 300);
-    if (!lock.locked()) {
-        clangDebug() << "failed to lock duchain in time";
-        return;
-    }
-    KTextEditor::Range simpleInvocationRange = KTextEditor::Range(sigAssistRange);
-    Declaration* funDecl = getDeclarationAtCursor(simpleInvocationRange.start(), m_document);
+    const auto generation = m_generation;
+    const auto document = m_document;
+    const auto cursor = sigAssistRange.start();
+    startJob([this, generation, document, cursor] {
+        const auto snapshot = takeSnapshot(document, cursor);
+        QMutexLocker lock(&m_pendingMutex);
+        m_pendingSnapshot = qMakePair(generation, snapshot);
+        QMetaObject::invokeMethod(this, "processSnapshot", Qt::QueuedConnection);
+    });
+}
+
+void AdaptSignatureAssistant::startJob(const std::function<void()>& job)
+{
+    ++m_startedJobs;
+    m_jobPool.start(new FunctionJob(job));
+}
+
+void AdaptSignatureAssistant::waitForDone()
+{
+    // processing the results of a job may start another one
+    int startedJobs;
+    do {
+        startedJobs = m_startedJobs;
+        m_jobPool.waitForDone();
+        QCoreApplication::processEvents();
+    } while (startedJobs != m_startedJobs);
+}
+
+AdaptSignatureAssistant::Snapshot AdaptSignatureAssistant::takeSnapshot(const QUrl& document, const KTextEditor::Cursor& cursor)
+{
+    Snapshot snapshot;
+
+    DUChainReadLocker lock;
+    Declaration* funDecl = getDeclarationAtCursor(cursor, document);
     if (!funDecl || !funDecl->type<FunctionType>()) {
-        return;
+        return snapshot;
     }
     /*
        TODO: Port?
@@ -137,34 +201,63 @@ void AdaptSignatureAssistant::textChanged(KTextEditor::View* view, const KTextEd
     Declaration* otherSide = 0;
     FunctionDefinition* definition = dynamic_cast<FunctionDefinition*>(funDecl);
     if (definition) {
-        m_editingDefinition = true;
+        snapshot.editingDefinition = true;
         otherSide = definition->declaration();
     } else if ((definition = FunctionDefinition::definition(funDecl))) {
-        m_editingDefinition = false;
+        snapshot.editingDefinition = false;
         otherSide = definition;
     }
     if (!otherSide) {
-        return;
+        return {};
+    }
+    snapshot.otherSideContext = DUContextPointer(DUChainUtils::getFunctionContext(otherSide));
+    if (!snapshot.otherSideContext) {
+        return {};
+    }
+    snapshot.declarationName = funDecl->identifier();
+    snapshot.otherSideId = otherSide->id();
+    snapshot.otherSideTopContext = ReferencedTopDUContext(otherSide->topContext());
+    snapshot.otherSideUrl = otherSide->topContext()->url();
+    snapshot.oldSignature = getDeclarationSignature(otherSide, snapshot.otherSideContext.data(), true);
+    return snapshot;
+}
+
+void AdaptSignatureAssistant::processSnapshot()
+{
+    QPair<int, Snapshot> pending;
+    {
+        QMutexLocker lock(&m_pendingMutex);
+        pending = m_pendingSnapshot;
+        m_pendingSnapshot = qMakePair(-1, Snapshot());
     }
-    m_otherSideContext = DUContextPointer(DUChainUtils::getFunctionContext(otherSide));
-    if (!m_otherSideContext) {
+    if (pending.first != m_generation || !pending.second.otherSideId.isValid()) {
         return;
     }
-    m_declarationName = funDecl->identifier();
-    m_otherSideId = otherSide->id();
-    m_otherSideTopContext = ReferencedTopDUContext(otherSide->topContext());
-    m_oldSignature = getDeclarationSignature(otherSide, m_otherSideContext.data(), true);
+    m_snapshot = pending.second;
 
     //Schedule an update, to make sure the ranges match
-    DUChain::self()->updateContextForUrl(m_otherSideTopContext->url(), TopDUContext::AllDeclarationsAndContexts);
+    m_otherSideUrl = m_snapshot.otherSideUrl;
+    m_otherSideUpdateTimer.start();
+
+    if (m_documentUpdated) {
+        // when the DUChain lock is contended, the update of the edited document can arrive first
+        m_documentUpdated = false;
+        compareSignatures();
+    }
+}
+
+void AdaptSignatureAssistant::updateOtherSide()
+{
+    // unlike DUChain::updateContextForUrl, this doesn't lock the DUChain
+    ICore::self()->languageController()->backgroundParser()->addDocument(m_otherSideUrl, TopDUContext::AllDeclarationsAndContexts);
 }
 
 bool AdaptSignatureAssistant::isUseful() const
 {
-    return !m_declarationName.isEmpty() && m_otherSideId.isValid();
+    return !m_snapshot.declarationName.isEmpty() && m_snapshot.otherSideId.isValid();
 }
 
-bool AdaptSignatureAssistant::getSignatureChanges(const Signature& newSignature, QList<int>& oldPositions) const
+bool AdaptSignatureAssistant::getSignatureChanges(const Signature& oldSignature, const Signature& newSignature, QList<int>& oldPositions)
 {
     bool changed = false;
     for (int i = 0; i < newSignature.parameters.size(); ++i) {
@@ -174,18 +267,18 @@ bool AdaptSignatureAssistant::getSignatureChanges(const Signature& newSignature,
     for (int curNewParam = newSignature.parameters.size() - 1; curNewParam >= 0; --curNewParam) {
         int foundAt = -1;
 
-        for (int curOldParam = m_oldSignature.parameters.size() - 1; curOldParam >= 0; --curOldParam) {
-            if (newSignature.parameters[curNewParam].first != m_oldSignature.parameters[curOldParam].first) {
+        for (int curOldParam = oldSignature.parameters.size() - 1; curOldParam >= 0; --curOldParam) {
+            if (newSignature.parameters[curNewParam].first != oldSignature.parameters[curOldParam].first) {
                 continue;  //Different type == different parameters
             }
-            if (newSignature.parameters[curNewParam].second == m_oldSignature.parameters[curOldParam].second || curOldParam == curNewParam) {
+            if (newSignature.parameters[curNewParam].second == oldSignature.parameters[curOldParam].second || curOldParam == curNewParam) {
                 //given the same type and either the same position or the same name, it's (probably) the same argument
                 foundAt = curOldParam;
 
-                if (newSignature.parameters[curNewParam].second != m_oldSignature.parameters[curOldParam].second || curOldParam != curNewParam) {
+                if (newSignature.parameters[curNewParam].second != oldSignature.parameters[curOldParam].second || curOldParam != curNewParam) {
                     changed = true;  //Either the name changed at this position, or position of this name has changed
                 }
-                if (newSignature.parameters[curNewParam].second == m_oldSignature.parameters[curOldParam].second) {
+                if (newSignature.parameters[curNewParam].second == oldSignature.parameters[curOldParam].second) {
                     break;  //Found an argument with the same name and type, no need to look further
                 }
                 //else: position/type match, but name match will trump, allowing: (int i=0, int j=1) => (int j=1, int i=0)
@@ -198,19 +291,19 @@ bool AdaptSignatureAssistant::getSignatureChanges(const Signature& newSignature,
         oldPositions[curNewParam] = foundAt;
     }
 
-    if (newSignature.parameters.size() != m_oldSignature.parameters.size()) {
+    if (newSignature.parameters.size() != oldSignature.parameters.size()) {
         changed = true;
     }
-    if (newSignature.isConst != m_oldSignature.isConst) {
+    if (newSignature.isConst != oldSignature.isConst) {
         changed = true;
     }
-    if (newSignature.returnType != m_oldSignature.returnType) {
+    if (newSignature.returnType != oldSignature.returnType) {
         changed = true;
     }
     return changed;
 }
 
-void AdaptSignatureAssistant::setDefaultParams(Signature& newSignature, const QList<int>& oldPositions) const
+void AdaptSignatureAssistant::setDefaultParams(const Signature& oldSignature, Signature& newSignature, const QList<int>& oldPositions)
 {
     bool hadDefaultParam = false;
     for (int i = 0; i < newSignature.defaultParams.size(); ++i) {
@@ -221,34 +314,33 @@ void AdaptSignatureAssistant::setDefaultParams(Signature& newSignature, const QL
                 newSignature.defaultParams[i] = QStringLiteral("{} /* TODO */");
             }
         } else {
-            newSignature.defaultParams[i] = m_oldSignature.defaultParams[oldPos];
+            newSignature.defaultParams[i] = oldSignature.defaultParams[oldPos];
             hadDefaultParam = hadDefaultParam || !newSignature.defaultParams[i].isEmpty();
         }
     }
 }
 
-QList<RenameAction*> AdaptSignatureAssistant::getRenameActions(const Signature &newSignature, const QList<int> &oldPositions) const
+QVector<AdaptSignatureAssistant::SignatureChanges::Rename> AdaptSignatureAssistant::getRenames(const Snapshot &snapshot, const Signature &newSignature, const QList<int> &oldPositions)
 {
     Q_ASSERT(DUChain::lock()->currentThreadHasReadLock());
-    QList<RenameAction*> renameActions;
-    if (!m_otherSideContext) {
-        return renameActions;
+    QVector<SignatureChanges::Rename> renames;
+    if (!snapshot.otherSideContext) {
+        return renames;
     }
     for (int i = newSignature.parameters.size() - 1; i >= 0; --i) {
         if (oldPositions[i] == -1) {
             continue;  //new parameter
         }
-        Declaration *renamedDecl = m_otherSideContext->localDeclarations()[oldPositions[i]];
-        if (newSignature.parameters[i].second != m_oldSignature.parameters[oldPositions[i]].second) {
+        Declaration *renamedDecl = snapshot.otherSideContext->localDeclarations()[oldPositions[i]];
+        if (newSignature.parameters[i].second != snapshot.oldSignature.parameters[oldPositions[i]].second) {
             QMap<IndexedString, QList<RangeInRevision> > uses = renamedDecl->uses();
             if (!uses.isEmpty()) {
-                renameActions << new RenameAction(renamedDecl->identifier(), newSignature.parameters[i].second,
-                                                  RevisionedFileRanges::convert(uses));
+                renames.append({renamedDecl->identifier(), newSignature.parameters[i].second, uses});
             }
         }
     }
 
-    return renameActions;
+    return renames;
 }
 
 void AdaptSignatureAssistant::updateReady(const KDevelop::IndexedString& document, const KDevelop::ReferencedTopDUContext& /*context*/)
@@ -256,19 +348,48 @@ void AdaptSignatureAssistant::updateReady(const KDevelop::IndexedString& documen
     if (document.toUrl() != m_document || !m_view) {
         return;
     }
+    if (!isUseful()) {
+        // the snapshot may still be taken in the background, processSnapshot compares then
+        m_documentUpdated = true;
+        return;
+    }
+    compareSignatures();
+}
+
+void AdaptSignatureAssistant::compareSignatures()
+{
+    if (!m_view) {
+        return;
+    }
     clearActions();
 
+    const auto generation = m_generation;
+    const auto snapshot = m_snapshot;
+    const auto cursor = KTextEditor::Cursor(m_view.data()->cursorPosition());
+    const auto url = m_document;
+    startJob([this, generation, snapshot, cursor, url] {
+        const auto changes = signatureChanges(url, cursor, snapshot);
+        QMutexLocker lock(&m_pendingMutex);
+        m_pendingChanges = qMakePair(generation, changes);
+        QMetaObject::invokeMethod(this, "processChanges", Qt::QueuedConnection);
+    });
+}
+
+AdaptSignatureAssistant::SignatureChanges AdaptSignatureAssistant::signatureChanges(const QUrl& document, const KTextEditor::Cursor& cursor, const Snapshot& snapshot)
+{
+    SignatureChanges changes;
+
     DUChainReadLocker lock;
 
-    Declaration *functionDecl = getDeclarationAtCursor(KTextEditor::Cursor(m_view.data()->cursorPosition()), m_document);
-    if (!functionDecl || functionDecl->identifier() != m_declarationName) {
-        clangDebug() << "No function found at" << m_document << m_view.data()->cursorPosition();
-        return;
+    Declaration *functionDecl = getDeclarationAtCursor(cursor, document);
+    if (!functionDecl || functionDecl->identifier() != snapshot.declarationName) {
+        clangDebug() << "No function found at" << document << cursor;
+        return changes;
     }
     DUContext *functionCtxt = DUChainUtils::getFunctionContext(functionDecl);
     if (!functionCtxt) {
         clangDebug() << "No function context found for" << functionDecl->toString();
-        return;
+        return changes;
     }
 #if 0 // TODO: Port
     if (QtFunctionDeclaration * classFun = dynamic_cast<QtFunctionDeclaration*>(functionDecl)) {
@@ -280,23 +401,46 @@ void AdaptSignatureAssistant::updateReady(const KDevelop::IndexedString& documen
 #endif
 
     //ParseJob having finished, get the signature that was modified
-    Signature newSignature = getDeclarationSignature(functionDecl, functionCtxt, false);
+    changes.valid = true;
+    changes.newSignature = getDeclarationSignature(functionDecl, functionCtxt, false);
+
+    //Check for changes between the old and the new signature, use oldPositions to store old<->new param index mapping
+    changes.changed = getSignatureChanges(snapshot.oldSignature, changes.newSignature, changes.oldPositions);
+    if (!changes.changed) {
+        return changes; //No changes to signature
+    }
+    if (snapshot.editingDefinition) {
+        setDefaultParams(snapshot.oldSignature, changes.newSignature, changes.oldPositions); //restore default parameters before updating the declarations
+    } else {
+        changes.renames = getRenames(snapshot, changes.newSignature, changes.oldPositions);  //rename as needed when updating the definition
+    }
+    return changes;
+}
 
-    //Check for changes between m_oldSignature and newSignature, use oldPositions to store old<->new param index mapping
-    QList<int> oldPositions;
-    if (!getSignatureChanges(newSignature, oldPositions)) {
+void AdaptSignatureAssistant::processChanges()
+{
+    QPair<int, SignatureChanges> pending;
+    {
+        QMutexLocker lock(&m_pendingMutex);
+        pending = m_pendingChanges;
+        m_pendingChanges = qMakePair(-1, SignatureChanges());
+    }
+    const auto& changes = pending.second;
+    if (pending.first != m_generation || !changes.valid) {
+        return;
+    }
+    if (!changes.changed) {
         reset();
-        return; //No changes to signature
+        return;
     }
+
     QList<RenameAction*> renameActions;
-    if (m_editingDefinition) {
-        setDefaultParams(newSignature, oldPositions); //restore default parameters before updating the declarations
-    } else {
-        renameActions = getRenameActions(newSignature, oldPositions);  //rename as needed when updating the definition
+    foreach (const auto& rename, changes.renames) {
+        renameActions << new RenameAction(rename.oldName, rename.newName, RevisionedFileRanges::convert(rename.uses));
     }
-    IAssistantAction::Ptr action(new AdaptSignatureAction(m_otherSideId, m_otherSideTopContext,
-                                                          m_oldSignature, newSignature,
-                                                          m_editingDefinition, renameActions));
+    IAssistantAction::Ptr action(new AdaptSignatureAction(m_snapshot.otherSideId, m_snapshot.otherSideTopContext,
+                                                          m_snapshot.oldSignature, changes.newSignature,
+                                                          m_snapshot.editingDefinition, renameActions));
     connect(action.data(), &IAssistantAction::executed,
             this, &AdaptSignatureAssistant::reset);
     addAction(action);
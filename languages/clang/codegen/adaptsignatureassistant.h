@@ -26,49 +26,122 @@
 #include <language/assistant/staticassistant.h>
 #include <language/duchain/identifier.h>
 #include <language/duchain/topducontext.h>
+#include <language/editor/rangeinrevision.h>
 
+#include <QMap>
+#include <QMutex>
 #include <QPointer>
+#include <QThreadPool>
+#include <QTimer>
 #include <QUrl>
 
+#include <functional>
+
 namespace KTextEditor {
 class View;
 }
 
+/**
+ * Offers to adapt the other side of a function when its signature gets edited
+ *
+ * The DUChain is never locked in the UI thread: the function at the cursor is looked up
+ * and compared in the background, and the actions are added once the results are in.
+ */
 class KDEVCLANGPRIVATE_EXPORT AdaptSignatureAssistant : public KDevelop::StaticAssistant
 {
     Q_OBJECT
 
 public:
     AdaptSignatureAssistant(KDevelop::ILanguageSupport* supportedLanguage);
+    ~AdaptSignatureAssistant() override;
 
     QString title() const override;
     void textChanged(KTextEditor::View* view, const KTextEditor::Range& invocationRange, const QString& removedText = QString()) override;
     bool isUseful() const override;
 
+    /**
+     * Block until the background jobs are done and their results got processed
+     *
+     * Used by the tests, to check the assistant after an edit.
+     */
+    void waitForDone();
+
 private:
-    ///Compare @param newSignature to m_oldSignature and put differences in oldPositions
+    /// The edited function and its other side, taken from the DUChain when the edit starts
+    struct Snapshot
+    {
+        // If this is true, the user is editing on the definition side,
+        // and the declaration should be updated
+        bool editingDefinition = false;
+        KDevelop::Identifier declarationName;
+        KDevelop::DeclarationId otherSideId;
+        KDevelop::ReferencedTopDUContext otherSideTopContext;
+        KDevelop::DUContextPointer otherSideContext;
+        KDevelop::IndexedString otherSideUrl;
+        //old signature of the _other_side
+        Signature oldSignature;
+    };
+
+    /// The differences between the edited signature and the old signature of the other side
+    struct SignatureChanges
+    {
+        struct Rename
+        {
+            KDevelop::Identifier oldName;
+            QString newName;
+            QMap<KDevelop::IndexedString, QList<KDevelop::RangeInRevision>> uses;
+        };
+
+        /// false when the edited function was not found
+        bool valid = false;
+        bool changed = false;
+        Signature newSignature;
+        QList<int> oldPositions;
+        /// the renamed parameters of the other side, when editing the declaration
+        QVector<Rename> renames;
+    };
+
+    /// NOTE: These lock the DUChain and must not be called in the UI thread
+    static Snapshot takeSnapshot(const QUrl& document, const KTextEditor::Cursor& cursor);
+    static SignatureChanges signatureChanges(const QUrl& document, const KTextEditor::Cursor& cursor, const Snapshot& snapshot);
+
+    ///Compare @param newSignature to @param oldSignature and put differences in oldPositions
     ///@returns whether or not there are any differences
-    bool getSignatureChanges(const Signature &newSignature, QList<int> &oldPositions) const;
-    ///Set default params in @param newSignature based on m_oldSignature's defaults and @param oldPositions
-    void setDefaultParams(Signature &newSignature, const QList<int> &oldPositions) const;
-    ///@returns RenameActions for each parameter in newSignature that has been renamed
-    QList<KDevelop::RenameAction*> getRenameActions(const Signature &newSignature, const QList<int> &oldPositions) const;
-
-    // If this is true, the user is editing on the definition side,
-    // and the declaration should be updated
-    bool m_editingDefinition = false;
-    KDevelop::Identifier m_declarationName;
-    KDevelop::DeclarationId m_otherSideId;
-    KDevelop::ReferencedTopDUContext m_otherSideTopContext;
-    KDevelop::DUContextPointer m_otherSideContext;
-    //old signature of the _other_side
-    Signature m_oldSignature;
+    static bool getSignatureChanges(const Signature &oldSignature, const Signature &newSignature, QList<int> &oldPositions);
+    ///Set default params in @param newSignature based on @param oldSignature's defaults and @param oldPositions
+    static void setDefaultParams(const Signature &oldSignature, Signature &newSignature, const QList<int> &oldPositions);
+    ///@returns the renames for each parameter in newSignature that has been renamed
+    static QVector<SignatureChanges::Rename> getRenames(const Snapshot &snapshot, const Signature &newSignature, const QList<int> &oldPositions);
+
+    void startJob(const std::function<void()>& job);
+    /// compare the signature at the cursor to the snapshot in the background
+    void compareSignatures();
+
+    Snapshot m_snapshot;
     QUrl m_document;
     QPointer<KTextEditor::View> m_view;
+    /// incremented on reset, such that the results of outdated background jobs are dropped
+    int m_generation = 0;
+    /// the edited document got updated before the snapshot was taken, so compare once it is
+    bool m_documentUpdated = false;
+    int m_startedJobs = 0;
+
+    /// the latest results of the background jobs, along with the generation they were started in
+    QMutex m_pendingMutex;
+    QPair<int, Snapshot> m_pendingSnapshot;
+    QPair<int, SignatureChanges> m_pendingChanges;
+    QThreadPool m_jobPool;
+
+    /// coalesces the updates of the other side during a burst of edits into a single reparse
+    QTimer m_otherSideUpdateTimer;
+    KDevelop::IndexedString m_otherSideUrl;
 
 private slots:
     void updateReady(const KDevelop::IndexedString& document, const KDevelop::ReferencedTopDUContext& context);
     void reset();
+    void processSnapshot();
+    void processChanges();
+    void updateOtherSide();
 };
 
 #endif // SIGNATUREASSISTANT_H
@@ -0,0 +1,125 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "astfiledependencies.h"
+
+#include "util/clangtypes.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+
+namespace {
+
+/// Bump this whenever the format of the dependencies file changes
+const quint32 dependenciesVersion = 1;
+
+QString dependenciesFile(const QString& astFile)
+{
+    return astFile + QStringLiteral(".deps");
+}
+
+QDataStream& operator<<(QDataStream& stream, const AstFileDependency& dependency)
+{
+    return stream << dependency.path << dependency.modificationTime;
+}
+
+QDataStream& operator>>(QDataStream& stream, AstFileDependency& dependency)
+{
+    return stream >> dependency.path >> dependency.modificationTime;
+}
+
+qint64 modificationTime(const QString& path)
+{
+    const QFileInfo info(path);
+    return info.exists() ? info.lastModified().toMSecsSinceEpoch() / 1000 : -1;
+}
+
+}
+
+QVector<AstFileDependency> AstFileDependencies::collect(CXTranslationUnit tu)
+{
+    QVector<AstFileDependency> dependencies;
+    clang_getInclusions(tu, [] (CXFile file, CXSourceLocation* /*stack*/, unsigned /*stackSize*/, CXClientData data) {
+        auto dependencies = static_cast<QVector<AstFileDependency>*>(data);
+        dependencies->append({ClangString(clang_getFileName(file)).toString(),
+                              static_cast<qint64>(clang_getFileTime(file))});
+    }, &dependencies);
+    return dependencies;
+}
+
+AstFileDependency AstFileDependencies::dependencyOnFile(const QString& path)
+{
+    return {path, modificationTime(path)};
+}
+
+QVector<AstFileDependency> AstFileDependencies::read(const QString& astFile, uint environmentHash)
+{
+    QFile file(dependenciesFile(astFile));
+    if (!QFile::exists(astFile) || !file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    QDataStream stream(&file);
+    quint32 version = 0;
+    uint hash = 0;
+    QVector<AstFileDependency> dependencies;
+    stream >> version;
+    if (version != dependenciesVersion) {
+        return {};
+    }
+    stream >> hash >> dependencies;
+    if (stream.status() != QDataStream::Ok || hash != environmentHash) {
+        return {};
+    }
+    return dependencies;
+}
+
+bool AstFileDependencies::write(const QString& astFile, uint environmentHash,
+                                const QVector<AstFileDependency>& dependencies)
+{
+    QSaveFile file(dependenciesFile(astFile));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << dependenciesVersion << environmentHash << dependencies;
+    return file.commit();
+}
+
+void AstFileDependencies::remove(const QString& astFile)
+{
+    QFile::remove(dependenciesFile(astFile));
+}
+
+bool AstFileDependencies::isUpToDate(const QVector<AstFileDependency>& dependencies)
+{
+    if (dependencies.isEmpty()) {
+        return false;
+    }
+    return std::all_of(dependencies.begin(), dependencies.end(), [] (const AstFileDependency& dependency) {
+        return modificationTime(dependency.path) == dependency.modificationTime;
+    });
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef ASTFILEDEPENDENCIES_H
+#define ASTFILEDEPENDENCIES_H
+
+#include <QString>
+#include <QVector>
+
+#include <clang-c/Index.h>
+
+#include "clangprivateexport.h"
+
+/**
+ * A file that went into an AST file written by clang_saveTranslationUnit
+ */
+struct AstFileDependency
+{
+    QString path;
+    qint64 modificationTime;
+};
+
+Q_DECLARE_TYPEINFO(AstFileDependency, Q_MOVABLE_TYPE);
+
+/**
+ * Tracks the files that went into AST files on disk, to only load those that are still up to date
+ *
+ * The dependencies are stored next to the AST file, together with the hash of the environment it was parsed in.
+ */
+namespace AstFileDependencies
+{
+/**
+ * @return the files included by @p tu, as reported by clang_getInclusions
+ */
+KDEVCLANGPRIVATE_EXPORT QVector<AstFileDependency> collect(CXTranslationUnit tu);
+
+/**
+ * @return the dependency on the file at @p path, with its current modification time
+ */
+KDEVCLANGPRIVATE_EXPORT AstFileDependency dependencyOnFile(const QString& path);
+
+/**
+ * Read the dependencies stored next to @p astFile
+ *
+ * @return the dependencies, or an empty list if they are missing or were written for another environment
+ */
+KDEVCLANGPRIVATE_EXPORT QVector<AstFileDependency> read(const QString& astFile, uint environmentHash);
+
+KDEVCLANGPRIVATE_EXPORT bool write(const QString& astFile, uint environmentHash,
+                                   const QVector<AstFileDependency>& dependencies);
+
+/**
+ * Remove the dependencies stored next to @p astFile, which invalidates it
+ */
+KDEVCLANGPRIVATE_EXPORT void remove(const QString& astFile);
+
+/**
+ * @return true when none of the @p dependencies changed or got removed
+ */
+KDEVCLANGPRIVATE_EXPORT bool isUpToDate(const QVector<AstFileDependency>& dependencies);
+}
+
+#endif // ASTFILEDEPENDENCIES_H
@@ -0,0 +1,170 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "buddyfileindex.h"
+
+#include "clanghelpers.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+namespace {
+
+QVector<BuddyFileIndex::DirectoryMapping> directoryMappingsFromEnvironment()
+{
+    const auto value = QString::fromLocal8Bit(qgetenv("KDEV_CLANG_BUDDY_DIRECTORIES"));
+    if (value.isEmpty()) {
+        return {{QStringLiteral("src"), QStringLiteral("include")}};
+    }
+
+    QVector<BuddyFileIndex::DirectoryMapping> mappings;
+    foreach (const auto& mapping, value.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        const auto directories = mapping.split(QLatin1Char(':'));
+        if (directories.size() == 2 && !directories[0].isEmpty() && !directories[1].isEmpty()) {
+            mappings.append({directories[0], directories[1]});
+        }
+    }
+    return mappings;
+}
+
+bool isIndexed(const QString& path)
+{
+    return ClangHelpers::isHeader(path) || ClangHelpers::isSource(path);
+}
+
+QStringRef directoryOf(const QString& path)
+{
+    return path.leftRef(path.lastIndexOf(QLatin1Char('/')));
+}
+
+}
+
+BuddyFileIndex::BuddyFileIndex()
+{
+    setDirectoryMappings(directoryMappingsFromEnvironment());
+}
+
+BuddyFileIndex::~BuddyFileIndex() = default;
+
+void BuddyFileIndex::setDirectoryMappings(const QVector<DirectoryMapping>& mappings)
+{
+    QMutexLocker lock(&m_mutex);
+    m_directoryAliases.clear();
+    foreach (const auto& mapping, mappings) {
+        m_directoryAliases.insert(mapping.headerDirectory, mapping.sourceDirectory);
+    }
+
+    m_filesByKey.clear();
+    foreach (const auto& file, m_files) {
+        m_filesByKey[buddyKey(file)].append(file);
+    }
+}
+
+void BuddyFileIndex::addFiles(const QStringList& paths)
+{
+    QMutexLocker lock(&m_mutex);
+    foreach (const auto& path, paths) {
+        if (!isIndexed(path) || m_files.contains(path)) {
+            continue;
+        }
+        m_files.insert(path);
+        m_filesByKey[buddyKey(path)].append(path);
+    }
+}
+
+void BuddyFileIndex::removeFiles(const QStringList& paths)
+{
+    QMutexLocker lock(&m_mutex);
+    foreach (const auto& path, paths) {
+        if (!m_files.remove(path)) {
+            continue;
+        }
+        auto it = m_filesByKey.find(buddyKey(path));
+        if (it != m_filesByKey.end()) {
+            it->removeOne(path);
+            if (it->isEmpty()) {
+                m_filesByKey.erase(it);
+            }
+        }
+    }
+}
+
+bool BuddyFileIndex::contains(const QString& path) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_files.contains(path);
+}
+
+QStringList BuddyFileIndex::buddies(const QString& path) const
+{
+    const bool header = ClangHelpers::isHeader(path);
+    if (!header && !ClangHelpers::isSource(path)) {
+        return {};
+    }
+
+    QStringList buddies;
+    {
+        QMutexLocker lock(&m_mutex);
+        foreach (const auto& file, m_filesByKey.value(buddyKey(path))) {
+            if (header ? ClangHelpers::isSource(file) : ClangHelpers::isHeader(file)) {
+                buddies.append(file);
+            }
+        }
+    }
+
+    const auto directory = directoryOf(path);
+    std::stable_sort(buddies.begin(), buddies.end(), [&directory] (const QString& lhs, const QString& rhs) {
+        return (directoryOf(lhs) == directory) > (directoryOf(rhs) == directory);
+    });
+    return buddies;
+}
+
+bool BuddyFileIndex::areBuddies(const QString& path1, const QString& path2) const
+{
+    const bool oppositeTypes = (ClangHelpers::isHeader(path1) && ClangHelpers::isSource(path2))
+                            || (ClangHelpers::isSource(path1) && ClangHelpers::isHeader(path2));
+    if (!oppositeTypes) {
+        return false;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    return m_files.contains(path1) && m_files.contains(path2) && buddyKey(path1) == buddyKey(path2);
+}
+
+QString BuddyFileIndex::buddyKey(const QString& path) const
+{
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    const int dot = path.lastIndexOf(QLatin1Char('.'));
+    const auto basePath = (dot > slash) ? path.left(dot) : path;
+    if (m_directoryAliases.isEmpty()) {
+        return basePath;
+    }
+
+    auto components = basePath.split(QLatin1Char('/'));
+    // the last component is the base name of the file
+    for (int i = 0; i < components.size() - 1; ++i) {
+        auto it = m_directoryAliases.constFind(components[i]);
+        if (it != m_directoryAliases.constEnd()) {
+            components[i] = it.value();
+        }
+    }
+    return components.join(QLatin1Char('/'));
+}
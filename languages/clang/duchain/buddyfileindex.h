@@ -0,0 +1,100 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef BUDDYFILEINDEX_H
+#define BUDDYFILEINDEX_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include "clangprivateexport.h"
+
+/**
+ * Index of the header and source files of the open projects by their base name, used to find buddy files.
+ *
+ * The index of the clang plugin is owned by its ClangIndex, see ClangIndex::buddyFileIndex.
+ *
+ * Headers and sources are buddies if they have the same base name and are in the same directory,
+ * or in corresponding directories according to the directory mappings, such as src/foo.cpp and include/foo.h.
+ * Queries don't access the file system.
+ */
+class KDEVCLANGPRIVATE_EXPORT BuddyFileIndex
+{
+public:
+    BuddyFileIndex();
+    ~BuddyFileIndex();
+
+    struct DirectoryMapping
+    {
+        QString sourceDirectory;
+        QString headerDirectory;
+    };
+
+    /**
+     * Set the names of directories whose sources are buddies of the headers in the corresponding header directories
+     *
+     * Defaults to src and include, which can be overridden via the KDEV_CLANG_BUDDY_DIRECTORIES environment variable,
+     * e.g. "src:include;lib:inc".
+     */
+    void setDirectoryMappings(const QVector<DirectoryMapping>& mappings);
+
+    /**
+     * Add the files at @p paths to the index, files which are neither headers nor sources are ignored
+     */
+    void addFiles(const QStringList& paths);
+    void removeFiles(const QStringList& paths);
+
+    /**
+     * @return true when the file at @p path is in the index
+     */
+    bool contains(const QString& path) const;
+
+    /**
+     * @return the indexed sources for the header at @p path or the indexed headers for the source at @p path,
+     *         the ones in the same directory first
+     */
+    QStringList buddies(const QString& path) const;
+
+    /**
+     * @return true when the indexed files at @p path1 and @p path2 are a header and a source with the same base name
+     *         in the same or in corresponding directories
+     */
+    bool areBuddies(const QString& path1, const QString& path2) const;
+
+private:
+    Q_DISABLE_COPY(BuddyFileIndex)
+
+    /// NOTE: m_mutex must be locked when calling this
+    QString buddyKey(const QString& path) const;
+
+    mutable QMutex m_mutex;
+    /// maps header directory names to the corresponding source directory names
+    QHash<QString, QString> m_directoryAliases;
+    QSet<QString> m_files;
+    /// the indexed files by their path without extension, with header directories mapped to source directories
+    QHash<QString, QStringList> m_filesByKey;
+};
+
+Q_DECLARE_TYPEINFO(BuddyFileIndex::DirectoryMapping, Q_MOVABLE_TYPE);
+
+#endif // BUDDYFILEINDEX_H
@@ -31,6 +31,7 @@
 #include "types/classspecializationtype.h"
 #include "util/clangdebug.h"
 #include "util/clangutils.h"
+#include "util/clangtrace.h"
 #include "util/clangtypes.h"
 
 #include <util/pushvalue.h>
@@ -52,6 +53,10 @@
 
 #include <clang-c/Documentation.h>
 
+#include <QTextStream>
+
+#include <atomic>
+#include <memory>
 #include <unordered_map>
 #include <typeinfo>
 
@@ -61,6 +66,9 @@
 
 namespace {
 
+/// see Builder::setMaxUsesPerLock
+std::atomic<int> s_maxUsesPerLock(1000);
+
 // TODO: this is ugly, can we find a better alternative?
 bool jsonTestRun()
 {
@@ -282,7 +290,8 @@ struct CurrentContext
 struct Visitor
 {
     explicit Visitor(CXTranslationUnit tu, CXFile file,
-                     const IncludeFileContexts& includes, const bool update);
+                     const IncludeFileContexts& includes, const bool update,
+                     Builder::DeclarationCache& declarationCache);
 
     AbstractType *makeType(CXType type, CXCursor parent);
     AbstractType::Ptr makeAbsType(CXType type, CXCursor parent)
@@ -337,6 +346,7 @@ struct Visitor
     template<CXCursorKind CK, class DeclType>
     DeclType* createDeclarationCommon(CXCursor cursor, const Identifier& id)
     {
+        ++m_createdDeclarations;
         auto range = ClangHelpers::cursorSpellingNameRange(cursor, id);
 
         if (id.isEmpty()) {
@@ -371,6 +381,7 @@ struct Visitor
                     m_parentContext->resortLocalDeclarations = true;
                     setDeclData<CK>(cursor, decl);
                     m_cursorToDeclarationCache[cursor] = decl;
+                    m_declarationCache.insert(cursor, DeclarationPointer(decl));
                     m_parentContext->previousChildDeclarations.erase(it);
                     return decl;
                 }
@@ -380,6 +391,7 @@ struct Visitor
         auto decl = new DeclType(range, nullptr);
         decl->setIdentifier(id);
         m_cursorToDeclarationCache[cursor] = decl;
+        m_declarationCache.insert(cursor, DeclarationPointer(decl));
         setDeclData<CK>(cursor, decl);
         {
             DUChainWriteLocker lock;
@@ -797,9 +809,14 @@ struct Visitor
     void setIdTypeDecl(CXCursor typeCursor, IdentifiedType* idType) const;
 
     std::unordered_map<DUContext*, std::vector<CXCursor>> m_uses;
+    /// counters for the trace, see @ref ClangTrace
+    int m_visitedCursors = 0;
+    int m_createdDeclarations = 0;
+    int m_createdUses = 0;
     /// At these location offsets (cf. @ref clang_getExpansionLocation) we encountered macro expansions
     QSet<unsigned int> m_macroExpansionLocations;
     mutable QHash<CXCursor, DeclarationPointer> m_cursorToDeclarationCache;
+    Builder::DeclarationCache& m_declarationCache;
     CurrentContext *m_parentContext;
 
     const bool m_update;
@@ -1185,8 +1202,15 @@ DeclarationPointer Visitor::findDeclaration(CXCursor cursor) const
         return *it;
     }
 
-    // fallback, and cache result
-    auto decl = ClangHelpers::findDeclaration(cursor, m_includes);
+    // declarations of other files that were built or used before
+    auto decl = m_declarationCache.find(cursor);
+    if (!decl) {
+        // fallback, and cache result
+        decl = ClangHelpers::findDeclaration(cursor, m_includes);
+        if (decl) {
+            m_declarationCache.insert(cursor, decl);
+        }
+    }
 
     m_cursorToDeclarationCache.insert(cursor, decl);
     return decl;
@@ -1304,9 +1328,11 @@ RangeInRevision rangeInRevisionForUse(CXCursor cursor, CXCursorKind referencedCu
 }
 
 Visitor::Visitor(CXTranslationUnit tu, CXFile file,
-                 const IncludeFileContexts& includes, const bool update)
+                 const IncludeFileContexts& includes, const bool update,
+                 Builder::DeclarationCache& declarationCache)
     : m_file(file)
     , m_includes(includes)
+    , m_declarationCache(declarationCache)
     , m_parentContext(nullptr)
     , m_update(update)
 {
@@ -1316,11 +1342,23 @@ Visitor::Visitor(CXTranslationUnit tu, CXFile file,
     clang_visitChildren(tuCursor, &visitCursor, this);
 
     TopDUContext *top = m_parentContext->context->topContext();
-    if (m_update) {
-        DUChainWriteLocker lock;
-        top->deleteUsesRecursively();
-    }
+
+    // First resolve the used declarations without holding the write lock, then create
+    // the uses in bounded chunks. Taking the write lock once per use, or once for all
+    // uses of a large file, starves everyone else waiting on the DUChain lock,
+    // most notably the UI thread.
+    struct ResolvedUse
+    {
+        DeclarationPointer used;
+        RangeInRevision range;
+    };
+    std::vector<std::pair<DUContext*, std::vector<ResolvedUse>>> resolvedUses;
+    resolvedUses.reserve(m_uses.size());
+
     for (const auto &contextUses : m_uses) {
+        std::vector<ResolvedUse> uses;
+        uses.reserve(contextUses.second.size());
+
         for (const auto &cursor : contextUses.second) {
             auto referenced = referencedCursor(cursor);
             if (clang_Cursor_isNull(referenced)) {
@@ -1340,9 +1378,7 @@ Visitor::Visitor(CXTranslationUnit tu, CXFile file,
             }
 
             if (!used) { // as a last resort, try to resolve the forward declaration
-                DUChainReadLocker lock;
-                DeclarationPointer decl = ClangHelpers::findForwardDeclaration(clang_getCursorType(referenced), contextUses.first, referenced);
-                used = decl;
+                used = ClangHelpers::findForwardDeclaration(clang_getCursorType(referenced), contextUses.first, referenced);
                 if (!used) {
                     continue;
                 }
@@ -1358,13 +1394,44 @@ Visitor::Visitor(CXTranslationUnit tu, CXFile file,
 #endif
 
             const auto useRange = clang_getCursorReferenceNameRange(cursor, 0, 0);
-            const auto range = rangeInRevisionForUse(cursor, referenced.kind, useRange, m_macroExpansionLocations);
+            uses.push_back({used, rangeInRevisionForUse(cursor, referenced.kind, useRange, m_macroExpansionLocations)});
+        }
 
-            DUChainWriteLocker lock;
-            auto usedIndex = top->indexForUsedDeclaration(used.data());
-            contextUses.first->createUse(usedIndex, range);
+        resolvedUses.emplace_back(contextUses.first, std::move(uses));
+    }
+
+    const int maxUsesPerLock = s_maxUsesPerLock.load(std::memory_order_relaxed);
+    ClangTrace::Scope lockTrace("wait for DUChain lock", ClangTrace::Scope::LockWait);
+    DUChainWriteLocker lock;
+    lockTrace.finish();
+    std::unique_ptr<ClangTrace::Scope> holdTrace(new ClangTrace::Scope("create uses"));
+    if (m_update) {
+        top->deleteUsesRecursively();
+    }
+    int usesInLock = 0;
+    for (const auto &contextUses : resolvedUses) {
+        for (const auto &use : contextUses.second) {
+            if (maxUsesPerLock && usesInLock == maxUsesPerLock) {
+                holdTrace->setArgument("uses", usesInLock);
+                holdTrace.reset();
+                lock.unlock();
+                ClangTrace::Scope chunkLockTrace("wait for DUChain lock", ClangTrace::Scope::LockWait);
+                lock.lock();
+                chunkLockTrace.finish();
+                holdTrace.reset(new ClangTrace::Scope("create uses"));
+                usesInLock = 0;
+            }
+            if (!use.used) {
+                // the declaration got deleted in the meantime
+                continue;
+            }
+            auto usedIndex = top->indexForUsedDeclaration(use.used.data());
+            contextUses.first->createUse(usedIndex, use.range);
+            ++m_createdUses;
+            ++usesInLock;
         }
     }
+    holdTrace->setArgument("uses", usesInLock);
 }
 
 //END Visitor
@@ -1372,6 +1439,7 @@ Visitor::Visitor(CXTranslationUnit tu, CXFile file,
 CXChildVisitResult visitCursor(CXCursor cursor, CXCursor parent, CXClientData data)
 {
     Visitor *visitor = static_cast<Visitor*>(data);
+    ++visitor->m_visitedCursors;
 
     const auto kind = clang_getCursorKind(cursor);
 
@@ -1449,9 +1517,69 @@ CXChildVisitResult visitCursor(CXCursor cursor, CXCursor parent, CXClientData da
 
 namespace Builder {
 
-void visit(CXTranslationUnit tu, CXFile file, const IncludeFileContexts& includes, const bool update)
+DeclarationCache::~DeclarationCache()
+{
+    if (qEnvironmentVariableIsSet("KDEV_CLANG_DISPLAY_DECLARATION_CACHE")) {
+        QMutexLocker lock(&m_mutex);
+        const int lookups = m_hits + m_misses;
+        QTextStream out(stdout);
+        out << "Declaration cache: " << m_declarations.size() << " entries, "
+            << m_hits << " hits, " << m_misses << " misses";
+        if (lookups) {
+            out << " (" << (100 * m_hits / lookups) << "% hit rate)";
+        }
+        out << "\n";
+    }
+}
+
+DeclarationPointer DeclarationCache::find(CXCursor cursor) const
+{
+    QMutexLocker lock(&m_mutex);
+    const auto it = m_declarations.constFind(cursor);
+    if (it == m_declarations.constEnd()) {
+        ++m_misses;
+        return {};
+    }
+    ++m_hits;
+    return *it;
+}
+
+void DeclarationCache::insert(CXCursor cursor, const DeclarationPointer& declaration)
+{
+    QMutexLocker lock(&m_mutex);
+    m_declarations.insert(cursor, declaration);
+}
+
+int DeclarationCache::hits() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_hits;
+}
+
+int DeclarationCache::misses() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_misses;
+}
+
+void setMaxUsesPerLock(int uses)
+{
+    s_maxUsesPerLock = qMax(0, uses);
+}
+
+int maxUsesPerLock()
+{
+    return s_maxUsesPerLock;
+}
+
+void visit(CXTranslationUnit tu, CXFile file, const IncludeFileContexts& includes, const bool update,
+           DeclarationCache& declarations)
 {
-    Visitor visitor(tu, file, includes, update);
+    ClangTrace::Scope trace("Builder::visit", file);
+    Visitor visitor(tu, file, includes, update, declarations);
+    trace.setArgument("cursors", visitor.m_visitedCursors);
+    trace.setArgument("declarations", visitor.m_createdDeclarations);
+    trace.setArgument("uses", visitor.m_createdUses);
 }
 
 }
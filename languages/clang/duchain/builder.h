@@ -26,16 +26,62 @@
 #include "clangprivateexport.h"
 
 #include "clanghelpers.h"
+#include "util/clangtypes.h"
+
+#include <QHash>
+#include <QMutex>
 
 namespace Builder {
 
+/**
+ * Maps the cursors of a translation unit to the declarations built or found for them
+ *
+ * A single cache is shared by all files built from the same translation unit, such that
+ * declarations used in another file than their own are not looked up in the DUChain again.
+ * Only cursors that have a declaration are cached, as they may refer to files not built yet.
+ *
+ * NOTE: This is thread safe.
+ */
+class KDEVCLANGPRIVATE_EXPORT DeclarationCache
+{
+public:
+    DeclarationCache() = default;
+    /// Prints the hits and misses when the environment variable KDEV_CLANG_DISPLAY_DECLARATION_CACHE is set
+    ~DeclarationCache();
+
+    KDevelop::DeclarationPointer find(CXCursor cursor) const;
+    void insert(CXCursor cursor, const KDevelop::DeclarationPointer& declaration);
+
+    int hits() const;
+    int misses() const;
+
+private:
+    Q_DISABLE_COPY(DeclarationCache)
+
+    mutable QMutex m_mutex;
+    QHash<CXCursor, KDevelop::DeclarationPointer> m_declarations;
+    mutable int m_hits = 0;
+    mutable int m_misses = 0;
+};
+
+/**
+ * Create at most @p uses uses while holding the DUChain write lock, such that other threads
+ * waiting for the lock, e.g. the UI thread, get it in between. Zero creates all uses of a file at once.
+ *
+ * Defaults to 1000.
+ */
+KDEVCLANGPRIVATE_EXPORT void setMaxUsesPerLock(int uses);
+KDEVCLANGPRIVATE_EXPORT int maxUsesPerLock();
+
 /**
  * Visit the AST in @p tu and build declarations for cursors belonging to @p file.
  * 
  * @param update Set to true when an existing DUChain cache is getting updated.
+ * @param declarations The cache shared by all files of @p tu.
  */
 KDEVCLANGPRIVATE_EXPORT void visit(CXTranslationUnit tu, CXFile file,
-                                   const IncludeFileContexts& includes, const bool update);
+                                   const IncludeFileContexts& includes, const bool update,
+                                   DeclarationCache& declarations);
 
 }
 
@@ -33,8 +33,11 @@
 #include "clangindex.h"
 #include "clangducontext.h"
 
+#include "util/clangtrace.h"
 #include "util/clangtypes.h"
 
+#include <QSet>
+
 #include <algorithm>
 
 using namespace KDevelop;
@@ -79,23 +82,200 @@ ReferencedTopDUContext createTopContext(const IndexedString& path, const ClangPa
     return context;
 }
 
+struct PreparedContext
+{
+    ReferencedTopDUContext context;
+    /// true when Builder::visit needs to run for this context
+    bool build = false;
+    /// true when an existing context gets updated
+    bool update = false;
+    /// true when the context is kept as-is since the content of its file did not change
+    bool unchanged = false;
+};
+
+/**
+ * @return a fingerprint of the contents of @p file as parsed in @p session, including unsaved contents
+ *
+ * NOTE: This is computed for every header that gets built, so it hashes the raw contents instead of
+ *       tokenizing the file again.
+ */
+uint contentFingerprint(const ParseSession& session, CXFile file)
+{
+    const auto contents = session.fileContents(file);
+    // 0 is reserved for contexts without fingerprint
+    return qMax(1u, qHash(contents));
 }
 
-Imports ClangHelpers::tuImports(CXTranslationUnit tu)
+bool anyImportRebuilt(CXFile file, const Imports& imports, const QSet<CXFile>& rebuiltFiles)
 {
-    Imports imports;
+    foreach(const auto& import, imports.values(file)) {
+        if (rebuiltFiles.contains(import.file)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Intentionally don't use clang_getInclusions here, as it skips already visited inclusions
-    // which makes TestDUChain::testNestedImports fail
-    CXCursor tuCursor = clang_getTranslationUnitCursor(tu);
-    clang_visitChildren(tuCursor, &visitCursor, &imports);
+/**
+ * Find or create the top context for @p file and set up its environment and imports,
+ * without building its declarations and uses yet.
+ *
+ * Headers whose content did not change since their context was built, and that don't import
+ * any file which gets rebuilt, are not built again even when their modification revision changed.
+ * All files that need to be built are added to @p rebuiltFiles.
+ *
+ * The caller must hold the UrlParseLock for @p path.
+ */
+PreparedContext prepareTopContext(CXFile file, const IndexedString& path, const Imports& imports,
+                                  const ParseSession& session, TopDUContext::Features features,
+                                  IncludeFileContexts& includedFiles, QSet<CXFile>& rebuiltFiles,
+                                  ClangIndex* index)
+{
+    const auto& environment = session.environment();
+    const bool isTranslationUnit = path == environment.translationUnitUrl();
+
+    PreparedContext prepared;
+    auto& context = prepared.context;
+
+    ClangTrace::Scope lockTrace("wait for DUChain lock", ClangTrace::Scope::LockWait);
+    DUChainWriteLocker lock;
+    lockTrace.finish();
+
+    uint fingerprint = 0;
+    auto computeFingerprint = [&]() {
+        if (!fingerprint) {
+            // reading the file doesn't need the DUChain, the context is protected by the UrlParseLock
+            lock.unlock();
+            fingerprint = contentFingerprint(session, file);
+            lock.lock();
+        }
+        return fingerprint;
+    };
 
-    return imports;
+    context = DUChain::self()->chainForDocument(path, &environment);
+    if (!context) {
+        context = ::createTopContext(path, environment);
+    } else {
+        prepared.update = true;
+    }
+
+    includedFiles.insert(file, context);
+    if (prepared.update) {
+        auto envFile = ClangParsingEnvironmentFile::Ptr(dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data()));
+        Q_ASSERT(envFile);
+        if (!envFile)
+            return prepared;
+
+        /* NOTE: When we are here, then either the translation unit or one of its headers was changed.
+         *       Thus we must always update the translation unit to propagate the change(s).
+         *       See also: https://bugs.kde.org/show_bug.cgi?id=356327
+         *       This assumes that headers are independent, we may need to improve that in the future
+         *       and also update header files more often when other files included therein got updated.
+         */
+        if (!isTranslationUnit && !envFile->needsUpdate(&environment) && envFile->featuresSatisfied(features)) {
+            return prepared;
+        } else if (!isTranslationUnit && envFile->featuresSatisfied(features) && !envFile->needsEnvironmentUpdate(environment)
+                   && envFile->contentFingerprint() && !anyImportRebuilt(file, imports, rebuiltFiles)
+                   && envFile->contentFingerprint() == computeFingerprint())
+        {
+            // only the modification revision changed, e.g. the file got touched or one of its imports
+            // got rebuilt without changes. the declarations and uses are still valid, so keep them
+            envFile->setModificationRevision(ModificationRevision::revisionForFile(context->url()));
+            prepared.unchanged = true;
+            return prepared;
+        } else {
+            //TODO: don't attempt to update if this environment is worse quality than the outdated one
+            if (index && envFile->environmentQuality() < environment.quality()) {
+                index->pinTranslationUnitForUrl(environment.translationUnitUrl(), path);
+            }
+            envFile->setEnvironment(environment);
+            envFile->setModificationRevision(ModificationRevision::revisionForFile(context->url()));
+        }
+
+        context->clearImportedParentContexts();
+    }
+    context->setFeatures(features);
+
+    foreach(const auto& import, imports.values(file)) {
+        Q_ASSERT(includedFiles.contains(import.file));
+        auto ctx = includedFiles.value(import.file);
+        if (!ctx) {
+            // happens for cyclic imports
+            continue;
+        }
+        context->addImportedParentContext(ctx, import.location);
+    }
+    context->updateImportsCache();
+
+    if (!isTranslationUnit) {
+        auto envFile = ClangParsingEnvironmentFile::Ptr(dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data()));
+        if (envFile) {
+            envFile->setContentFingerprint(computeFingerprint());
+        }
+    }
+
+    rebuiltFiles.insert(file);
+    prepared.build = true;
+    return prepared;
 }
 
-ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& imports, const ParseSession& session,
-                                                  TopDUContext::Features features, IncludeFileContexts& includedFiles,
-                                                  ClangIndex* index)
+/**
+ * Set the problems of @p file on its @p context
+ *
+ * To-do items are only extracted for files that get built, i.e. that are new or changed.
+ * The content of @p unchanged files is the same as when their to-do items were extracted,
+ * so those are kept.
+ */
+void setProblems(CXFile file, const ParseSession& session, const ReferencedTopDUContext& context, bool unchanged = false)
+{
+    auto problems = session.problemsForFile(file, unchanged ? ParseSession::SkipTodos : ParseSession::ExtractTodos);
+    DUChainWriteLocker lock;
+    if (unchanged) {
+        // copy the previous to-do items, the problem objects are owned by the context's storage
+        foreach (const auto& problem, context->problems()) {
+            if (problem->source() != IProblem::ToDo) {
+                continue;
+            }
+            ProblemPointer todo(new Problem);
+            todo->setDescription(problem->description());
+            todo->setSeverity(problem->severity());
+            todo->setSource(IProblem::ToDo);
+            todo->setFinalLocation(problem->finalLocation());
+            problems << todo;
+        }
+    }
+    context->setProblems(problems);
+}
+
+IndexedString canonicalPath(CXFile file)
+{
+    return IndexedString(QDir(ClangString(clang_getFileName(file)).toString()).canonicalPath());
+}
+
+/**
+ * Collect @p file and all files it imports, in the order buildDUChain visits them:
+ * every file comes after the files it imports, except for cyclic imports.
+ */
+void collectFiles(CXFile file, const Imports& imports, IncludeFileContexts& includedFiles, QVector<CXFile>* files)
+{
+    if (includedFiles.contains(file)) {
+        return;
+    }
+
+    // prevent recursion
+    includedFiles.insert(file, {});
+
+    foreach(const auto& import, imports.values(file)) {
+        collectFiles(import.file, imports, includedFiles, files);
+    }
+
+    files->append(file);
+}
+
+ReferencedTopDUContext buildDUChainRecursive(CXFile file, const Imports& imports, const ParseSession& session,
+                                             TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                             QSet<CXFile>& rebuiltFiles, Builder::DeclarationCache& declarations,
+                                             ClangIndex* index)
 {
     if (includedFiles.contains(file)) {
         return {};
@@ -106,80 +286,124 @@ ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& im
 
     // ensure DUChain for imports are build properly
     foreach(const auto& import, imports.values(file)) {
-        buildDUChain(import.file, imports, session, features, includedFiles, index);
+        buildDUChainRecursive(import.file, imports, session, features, includedFiles, rebuiltFiles, declarations, index);
     }
 
-    const IndexedString path(QDir(ClangString(clang_getFileName(file)).toString()).canonicalPath());
+    const IndexedString path = canonicalPath(file);
     if (path.isEmpty()) {
         // may happen when the file gets removed before the job is run
         return {};
     }
 
-    const auto& environment = session.environment();
-
-    bool update = false;
+    ClangTrace::Scope lockTrace("wait for URL parse lock", ClangTrace::Scope::LockWait);
     UrlParseLock urlLock(path);
-    ReferencedTopDUContext context;
-    {
-        DUChainWriteLocker lock;
-        context = DUChain::self()->chainForDocument(path, &environment);
-        if (!context) {
-            context = ::createTopContext(path, environment);
-        } else {
-            update = true;
-        }
+    lockTrace.finish();
+    const auto prepared = prepareTopContext(file, path, imports, session, features, includedFiles, rebuiltFiles, index);
+    if (prepared.unchanged) {
+        setProblems(file, session, prepared.context, true);
+    }
+    if (!prepared.build) {
+        return prepared.context;
+    }
 
-        includedFiles.insert(file, context);
-        if (update) {
-            auto envFile = ClangParsingEnvironmentFile::Ptr(dynamic_cast<ClangParsingEnvironmentFile*>(context->parsingEnvironmentFile().data()));
-            Q_ASSERT(envFile);
-            if (!envFile)
-                return context;
-
-            /* NOTE: When we are here, then either the translation unit or one of its headers was changed.
-             *       Thus we must always update the translation unit to propagate the change(s).
-             *       See also: https://bugs.kde.org/show_bug.cgi?id=356327
-             *       This assumes that headers are independent, we may need to improve that in the future
-             *       and also update header files more often when other files included therein got updated.
-             */
-            if (path != environment.translationUnitUrl() && !envFile->needsUpdate(&environment) && envFile->featuresSatisfied(features)) {
-                return context;
-            } else {
-                //TODO: don't attempt to update if this environment is worse quality than the outdated one
-                if (index && envFile->environmentQuality() < environment.quality()) {
-                    index->pinTranslationUnitForUrl(environment.translationUnitUrl(), path);
-                }
-                envFile->setEnvironment(environment);
-                envFile->setModificationRevision(ModificationRevision::revisionForFile(context->url()));
-            }
+    setProblems(file, session, prepared.context);
 
-            context->clearImportedParentContexts();
-        }
-        context->setFeatures(features);
+    Builder::visit(session.unit(), file, includedFiles, prepared.update, declarations);
+
+    DUChain::self()->emitUpdateReady(path, prepared.context);
+
+    return prepared.context;
+}
+
+}
+
+Imports ClangHelpers::tuImports(CXTranslationUnit tu)
+{
+    Imports imports;
+
+    // Intentionally don't use clang_getInclusions here, as it skips already visited inclusions
+    // which makes TestDUChain::testNestedImports fail
+    CXCursor tuCursor = clang_getTranslationUnitCursor(tu);
+    clang_visitChildren(tuCursor, &visitCursor, &imports);
+
+    return imports;
+}
+
+ReferencedTopDUContext ClangHelpers::buildDUChain(CXFile file, const Imports& imports, const ParseSession& session,
+                                                  TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                                  ClangIndex* index, Builder::DeclarationCache* sharedDeclarations)
+{
+    ClangTrace::Scope trace("ClangHelpers::buildDUChain", file);
+    QSet<CXFile> rebuiltFiles;
+    // shared by all files, such that declarations used across files are looked up only once
+    Builder::DeclarationCache localDeclarations;
+    auto& declarations = sharedDeclarations ? *sharedDeclarations : localDeclarations;
+    const auto context = buildDUChainRecursive(file, imports, session, features, includedFiles, rebuiltFiles, declarations, index);
+    trace.setArgument("files", includedFiles.size());
+    trace.setArgument("rebuilt files", rebuiltFiles.size());
+    return context;
+}
+
+ReferencedTopDUContext ClangHelpers::buildMainFileDUChain(CXFile file, const Imports& imports, const ParseSession& session,
+                                                          TopDUContext::Features features, IncludeFileContexts& includedFiles,
+                                                          ClangIndex* index)
+{
+    ClangTrace::Scope trace("ClangHelpers::buildMainFileDUChain", file);
+    QVector<CXFile> files;
+    collectFiles(file, imports, includedFiles, &files);
+    if (files.isEmpty()) {
+        return {};
+    }
+    files.removeOne(file);
+
+    QVector<IndexedString> paths;
+    paths.reserve(files.size());
+    for (auto includedFile : files) {
+        paths.append(canonicalPath(includedFile));
+    }
 
-        foreach(const auto& import, imports.values(file)) {
-            Q_ASSERT(includedFiles.contains(import.file));
-            auto ctx = includedFiles.value(import.file);
-            if (!ctx) {
-                // happens for cyclic imports
+    const auto& environment = session.environment();
+    {
+        DUChainReadLocker lock;
+        for (int i = 0; i < files.size(); ++i) {
+            if (paths[i].isEmpty()) {
+                continue;
+            }
+            auto context = DUChain::self()->chainForDocument(paths[i], &environment);
+            if (!context) {
                 continue;
             }
-            context->addImportedParentContext(ctx, import.location);
+            auto envFile = context->parsingEnvironmentFile();
+            if (envFile && !envFile->needsUpdate(&environment) && envFile->featuresSatisfied(features)) {
+                includedFiles[files[i]] = context;
+            }
         }
-        context->updateImportsCache();
     }
 
-    const auto problems = session.problemsForFile(file);
-    {
-        DUChainWriteLocker lock;
-        context->setProblems(problems);
+    const IndexedString path = canonicalPath(file);
+    if (path.isEmpty()) {
+        // may happen when the file gets removed before the job is run
+        return {};
     }
 
-    Builder::visit(session.unit(), file, includedFiles, update);
+    UrlParseLock urlLock(path);
+    QSet<CXFile> rebuiltFiles;
+    const auto prepared = prepareTopContext(file, path, imports, session, features, includedFiles, rebuiltFiles, index);
+    if (prepared.unchanged) {
+        setProblems(file, session, prepared.context, true);
+    }
+    if (!prepared.build) {
+        return prepared.context;
+    }
 
-    DUChain::self()->emitUpdateReady(path, context);
+    setProblems(file, session, prepared.context);
 
-    return context;
+    Builder::DeclarationCache declarations;
+    Builder::visit(session.unit(), file, includedFiles, prepared.update, declarations);
+
+    DUChain::self()->emitUpdateReady(path, prepared.context);
+
+    return prepared.context;
 }
 
 DeclarationPointer ClangHelpers::findDeclaration(CXSourceLocation location, const ReferencedTopDUContext& top)
@@ -31,6 +31,10 @@
 class ParseSession;
 class ClangIndex;
 
+namespace Builder {
+class DeclarationCache;
+}
+
 struct Import
 {
     CXFile file;
@@ -68,9 +72,29 @@ KDEVCLANGPRIVATE_EXPORT Imports tuImports(CXTranslationUnit tu);
  * Recursively builds a duchain with the specified @param features for the
  * @param file and each of its @param imports using the TU from @param session.
  * The resulting contexts are placed in @param includedFiles.
+ * When @param declarations is set, it is used as the cache shared by all files,
+ * otherwise a temporary one is.
  * @returns the context created for @param file
  */
 KDEVCLANGPRIVATE_EXPORT KDevelop::ReferencedTopDUContext buildDUChain(
+    CXFile file, const Imports& imports, const ParseSession& session,
+    KDevelop::TopDUContext::Features features, IncludeFileContexts& includedFiles,
+    ClangIndex* index = nullptr, Builder::DeclarationCache* declarations = nullptr);
+
+/**
+ * Builds a duchain with the specified @param features for the @param file only,
+ * using the TU from @param session. Its @param imports are not built, only the
+ * up-to-date contexts that already exist for them are imported.
+ *
+ * This publishes the context of @param file much earlier than @ref buildDUChain
+ * when its headers were not built before. Uses of declarations from headers without
+ * an up-to-date context stay unresolved until the full duchain is built.
+ *
+ * The contexts used for the imports are placed in @param includedFiles,
+ * imports that were skipped are mapped to a null context.
+ * @returns the context created for @param file
+ */
+KDEVCLANGPRIVATE_EXPORT KDevelop::ReferencedTopDUContext buildMainFileDUChain(
     CXFile file, const Imports& imports, const ParseSession& session,
     KDevelop::TopDUContext::Features features, IncludeFileContexts& includedFiles,
     ClangIndex* index = nullptr);
@@ -21,6 +21,7 @@
 
 #include "clangindex.h"
 
+#include "astfiledependencies.h"
 #include "clangpch.h"
 #include "clangparsingenvironment.h"
 #include "documentfinderhelpers.h"
@@ -32,11 +33,56 @@
 
 #include <clang-c/Index.h>
 
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+#include <algorithm>
+
 using namespace KDevelop;
 
+namespace {
+/// Bump this whenever the on-disk format of the pinned translation units changes
+const quint32 pinStorageVersion = 3;
+
+quint64 pchCacheBudgetFromEnvironment()
+{
+    bool ok = false;
+    const auto megabytes = qgetenv("KDEV_CLANG_PCH_CACHE_SIZE").toULongLong(&ok);
+    return (ok ? megabytes : 512) * 1024 * 1024;
+}
+
+quint64 pchDiskCacheBudgetFromEnvironment()
+{
+    bool ok = false;
+    const auto megabytes = qgetenv("KDEV_CLANG_PCH_DISK_CACHE_SIZE").toULongLong(&ok);
+    return (ok ? megabytes : 1024) * 1024 * 1024;
+}
+
+bool lessByIndex(const IndexedString& lhs, const IndexedString& rhs)
+{
+    return lhs.index() < rhs.index();
+}
+
+void sortByIndex(QVector<IndexedString>* files)
+{
+    std::sort(files->begin(), files->end(), lessByIndex);
+}
+}
+
 ClangIndex::ClangIndex()
     // NOTE: We don't exclude PCH declarations. That way we could retrieve imports manually, as clang_getInclusions returns nothing on reparse with CXTranslationUnit_PrecompiledPreamble flag.
     : m_index(clang_createIndex(0 /*Exclude PCH Decls*/, qEnvironmentVariableIsSet("KDEV_CLANG_DISPLAY_DIAGS") /*Display diags*/))
+    , m_pchCacheBudget(pchCacheBudgetFromEnvironment())
+    , m_pchDiskCacheBudget(pchDiskCacheBudgetFromEnvironment())
+    , m_pchCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kdevclangsupport/pch"))
+    , m_sharedPreambles(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kdevclangsupport/preambles"))
+    , m_translationUnitCache(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kdevclangsupport/tus"))
 {
 }
 
@@ -54,36 +100,235 @@ QSharedPointer<const ClangPCH> ClangIndex::pch(const ClangParsingEnvironment& en
 
     UrlParseLock pchLock(IndexedString(pchInclude.pathOrUrl()));
 
-    static const QString pchExt = QStringLiteral(".pch");
+    const PchCacheKey key(pchInclude.pathOrUrl(), environment.hash());
+    QSharedPointer<const ClangPCH> cached;
+    {
+        QMutexLocker lock(&m_pchMutex);
+        auto it = m_pch.find(key);
+        if (it != m_pch.end()) {
+            it->lastUsed = ++m_pchUseCounter;
+            cached = it->pch;
+        }
+    }
+
+    // stat the dependencies without holding the mutex, such that parse jobs using other PCHs don't wait for it.
+    // the PCH of this key can't be replaced meanwhile, that is guarded by the URL parse lock
+    if (cached) {
+        const bool upToDate = cached->isUpToDate();
+        QMutexLocker lock(&m_pchMutex);
+        if (upToDate) {
+            ++m_pchStatistics.hits;
+            return cached;
+        }
+        // never reuse a stale PCH
+        auto it = m_pch.find(key);
+        if (it != m_pch.end() && it->pch == cached) {
+            m_pchCacheUsage -= it->pch->memoryUsage();
+            m_pch.erase(it);
+        }
+    }
 
-    if (QFile::exists(pchInclude.toLocalFile() + pchExt)) {
-        QReadLocker lock(&m_pchLock);
-        auto pch = m_pch.constFind(pchInclude);
-        if (pch != m_pch.constEnd()) {
-            return pch.value();
+    auto pch = QSharedPointer<ClangPCH>::create(environment, this, pchCacheFile(environment));
+    if (!pch->context()) {
+        qCWarning(KDEV_CLANG) << "Failed to create precompiled header for" << pchInclude;
+        return {};
+    }
+
+    {
+        QMutexLocker lock(&m_pchMutex);
+        if (pch->isLoadedFromDisk()) {
+            ++m_pchStatistics.diskHits;
+        } else {
+            ++m_pchStatistics.misses;
         }
+        m_pch.insert(key, {pch, ++m_pchUseCounter});
+        m_pchCacheUsage += pch->memoryUsage();
+        evictPchs();
     }
 
-    auto pch = QSharedPointer<ClangPCH>::create(environment, this);
-    QWriteLocker lock(&m_pchLock);
-    m_pch.insert(pchInclude, pch);
+    if (!pch->isLoadedFromDisk() && !pch->pchFile().isEmpty()) {
+        evictPchFiles();
+    }
     return pch;
 }
 
+void ClangIndex::setPchCacheBudget(quint64 bytes)
+{
+    QMutexLocker lock(&m_pchMutex);
+    m_pchCacheBudget = bytes;
+    evictPchs();
+}
+
+void ClangIndex::setPchCacheDirectory(const QString& directory)
+{
+    QMutexLocker lock(&m_pchMutex);
+    m_pchCacheDirectory = directory;
+}
+
+void ClangIndex::setPchDiskCacheBudget(quint64 bytes)
+{
+    {
+        QMutexLocker lock(&m_pchMutex);
+        m_pchDiskCacheBudget = bytes;
+    }
+    evictPchFiles();
+}
+
+QSharedPointer<const QString> ClangIndex::referencePchFile(const QString& path)
+{
+    QMutexLocker lock(&m_pchMutex);
+    auto& weakReference = m_pchFileReferences[path];
+    auto reference = weakReference.toStrongRef();
+    if (!reference) {
+        reference = QSharedPointer<const QString>::create(path);
+        weakReference = reference;
+    }
+    return reference;
+}
+
+ClangIndex::PchCacheStatistics ClangIndex::pchCacheStatistics() const
+{
+    QMutexLocker lock(&m_pchMutex);
+    return m_pchStatistics;
+}
+
+void ClangIndex::evictPchs()
+{
+    // always keep the most recently used PCH, even if it exceeds the budget on its own
+    while (m_pchCacheUsage > m_pchCacheBudget && m_pch.size() > 1) {
+        auto lru = std::min_element(m_pch.begin(), m_pch.end(), [] (const PchCacheEntry& lhs, const PchCacheEntry& rhs) {
+            return lhs.lastUsed < rhs.lastUsed;
+        });
+        clangDebug() << "Evicting precompiled header" << lru.key().first << "from memory";
+        m_pchCacheUsage -= lru->pch->memoryUsage();
+        m_pch.erase(lru);
+        ++m_pchStatistics.evictions;
+    }
+}
+
+void ClangIndex::evictPchFiles()
+{
+    QString directory;
+    quint64 budget;
+    QSet<QString> usedFiles;
+    {
+        QMutexLocker lock(&m_pchMutex);
+        directory = m_pchCacheDirectory;
+        budget = m_pchDiskCacheBudget;
+        foreach (const auto& entry, m_pch) {
+            usedFiles.insert(QFileInfo(entry.pch->pchFile()).fileName());
+        }
+        for (auto it = m_pchFileReferences.begin(); it != m_pchFileReferences.end();) {
+            if (it->isNull()) {
+                it = m_pchFileReferences.erase(it);
+            } else {
+                usedFiles.insert(QFileInfo(it.key()).fileName());
+                ++it;
+            }
+        }
+    }
+    if (directory.isEmpty()) {
+        return;
+    }
+
+    auto files = QDir(directory).entryInfoList({QStringLiteral("*.pch")}, QDir::Files);
+    quint64 size = 0;
+    foreach (const auto& file, files) {
+        size += file.size();
+    }
+    if (size <= budget) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [] (const QFileInfo& lhs, const QFileInfo& rhs) {
+        return lhs.lastModified() < rhs.lastModified();
+    });
+    // the PCHs in memory and the translation units using a PCH may get reparsed against their files, so keep those
+    for (int i = 0; i < files.size() && size > budget; ++i) {
+        if (usedFiles.contains(files[i].fileName())) {
+            continue;
+        }
+        const auto path = files[i].absoluteFilePath();
+        clangDebug() << "Evicting precompiled header" << path << "from disk";
+        AstFileDependencies::remove(path);
+        QFile::remove(path);
+        size -= files[i].size();
+    }
+}
+
+QString ClangIndex::pchCacheFile(const ClangParsingEnvironment& environment) const
+{
+    QString directory;
+    {
+        QMutexLocker lock(&m_pchMutex);
+        directory = m_pchCacheDirectory;
+    }
+    if (directory.isEmpty() || !QDir().mkpath(directory)) {
+        return {};
+    }
+
+    // name the file after everything that influences the contents of the PCH,
+    // changes to the contents of the included files are detected by ClangPCH itself
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(environment.pchInclude().toLocalFile().toUtf8());
+    hash.addData(QByteArray::number(environment.hash()));
+    hash.addData(ClangString(clang_getClangVersion()).toByteArray());
+    return directory + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".pch");
+}
+
 ClangIndex::~ClangIndex()
 {
+    // the queued translation units must be written before the index is disposed
+    m_translationUnitCache.waitForSaved();
+    {
+        QMutexLocker lock(&m_mappingMutex);
+        savePins();
+    }
+    {
+        QMutexLocker lock(&m_pchMutex);
+        if (m_pchStatistics.hits || m_pchStatistics.diskHits || m_pchStatistics.misses) {
+            clangDebug() << "PCH cache statistics: hits" << m_pchStatistics.hits
+                         << "disk hits" << m_pchStatistics.diskHits
+                         << "misses" << m_pchStatistics.misses
+                         << "evictions" << m_pchStatistics.evictions;
+        }
+        // the translation units of the PCHs must be disposed before the index
+        m_pch.clear();
+    }
     clang_disposeIndex(m_index);
 }
 
+SharedPreambles* ClangIndex::sharedPreambles()
+{
+    return &m_sharedPreambles;
+}
+
+TranslationUnitCache* ClangIndex::translationUnitCache()
+{
+    return &m_translationUnitCache;
+}
+
+BuddyFileIndex* ClangIndex::buddyFileIndex()
+{
+    return &m_buddyFileIndex;
+}
+
+UnsavedFileCache* ClangIndex::unsavedFileCache()
+{
+    return &m_unsavedFileCache;
+}
+
 IndexedString ClangIndex::translationUnitForUrl(const IndexedString& url)
 {
     { // try explicit pin data first
         QMutexLocker lock(&m_mappingMutex);
+        ensurePinsLoaded();
         auto tu = m_tuForUrl.find(url);
         if (tu != m_tuForUrl.end()) {
             if (!QFile::exists(tu.value().str())) {
                 // TU doesn't exist, unpin
                 m_tuForUrl.erase(tu);
+                m_pinsChanged = true;
                 return url;
             }
             return tu.value();
@@ -91,7 +336,15 @@ IndexedString ClangIndex::translationUnitForUrl(const IndexedString& url)
     }
     // otherwise, fallback to a simple buddy search for headers
     if (ClangHelpers::isHeader(url.str())) {
-        foreach(const QUrl& buddy, DocumentFinderHelpers::getPotentialBuddies(url.toUrl(), false)) {
+        if (m_buddyFileIndex.contains(url.str())) {
+            // the indexed buddies exist, so there's no need to check the file system
+            const auto buddies = m_buddyFileIndex.buddies(url.str());
+            if (!buddies.isEmpty()) {
+                return IndexedString(buddies.first());
+            }
+            // the buddy may not belong to any open project, e.g. a source that's not part of the build system
+        }
+        foreach(const QUrl& buddy, DocumentFinderHelpers::getPotentialBuddies(url.toUrl(), nullptr, false)) {
             const QString buddyPath = buddy.toLocalFile();
             if (QFile::exists(buddyPath)) {
                 return IndexedString(buddyPath);
@@ -104,11 +357,203 @@ IndexedString ClangIndex::translationUnitForUrl(const IndexedString& url)
 void ClangIndex::pinTranslationUnitForUrl(const IndexedString& tu, const IndexedString& url)
 {
     QMutexLocker lock(&m_mappingMutex);
-    m_tuForUrl.insert(url, tu);
+    ensurePinsLoaded();
+    auto it = m_tuForUrl.find(url);
+    if (it == m_tuForUrl.end() || it.value() != tu) {
+        m_tuForUrl.insert(url, tu);
+        m_pinsChanged = true;
+    }
 }
 
 void ClangIndex::unpinTranslationUnitForUrl(const IndexedString& url)
 {
     QMutexLocker lock(&m_mappingMutex);
-    m_tuForUrl.remove(url);
+    ensurePinsLoaded();
+    if (m_tuForUrl.remove(url)) {
+        m_pinsChanged = true;
+    }
+}
+
+void ClangIndex::setIncludedFiles(const IndexedString& tu, const QVector<IndexedString>& files)
+{
+    auto sortedFiles = files;
+    sortByIndex(&sortedFiles);
+    sortedFiles.erase(std::unique(sortedFiles.begin(), sortedFiles.end()), sortedFiles.end());
+
+    QMutexLocker lock(&m_mappingMutex);
+    ensurePinsLoaded();
+    if (m_includedFiles.value(tu) == sortedFiles) {
+        return;
+    }
+    if (sortedFiles.isEmpty()) {
+        m_includedFiles.remove(tu);
+    } else {
+        m_includedFiles.insert(tu, sortedFiles);
+    }
+    m_pinsChanged = true;
+}
+
+QVector<IndexedString> ClangIndex::dependentTranslationUnits(const IndexedString& file)
+{
+    QMutexLocker lock(&m_mappingMutex);
+    ensurePinsLoaded();
+
+    // this is only needed when a header changed, so a scan beats keeping the reverse mapping in memory
+    QVector<IndexedString> tus;
+    for (auto it = m_includedFiles.begin(); it != m_includedFiles.end();) {
+        if (!std::binary_search(it->constBegin(), it->constEnd(), file, lessByIndex)) {
+            ++it;
+        } else if (!QFile::exists(it.key().str())) {
+            // TU got removed, drop its included files
+            it = m_includedFiles.erase(it);
+            m_pinsChanged = true;
+        } else {
+            tus.append(it.key());
+            ++it;
+        }
+    }
+    return tus;
+}
+
+void ClangIndex::setPinStoragePath(const QString& path)
+{
+    QMutexLocker lock(&m_mappingMutex);
+    if (m_pinStoragePath == path) {
+        return;
+    }
+    // write back what we have so far, then load the new storage on next access
+    savePins();
+    m_pinStoragePath = path;
+    m_pinsLoaded = false;
+}
+
+void ClangIndex::ensurePinsLoaded()
+{
+    if (m_pinsLoaded) {
+        return;
+    }
+    m_pinsLoaded = true;
+
+    if (m_pinStoragePath.isEmpty()) {
+        return;
+    }
+
+    QFile file(m_pinStoragePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    quint32 version = 0;
+    stream >> version;
+    if (version != pinStorageVersion) {
+        clangDebug() << "Ignoring pinned translation units with unsupported version" << version;
+        return;
+    }
+
+    QHash<QString, QString> pins;
+    QStringList paths;
+    QHash<quint32, QVector<quint32>> includedFiles;
+    stream >> pins >> paths >> includedFiles;
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(KDEV_CLANG) << "Failed to read pinned translation units from" << m_pinStoragePath;
+        return;
+    }
+
+    // NOTE: we don't check whether the files still exist here, as this is potentially run
+    //       in the foreground. Pins of removed TUs are dropped in translationUnitForUrl,
+    //       pins of removed files are dropped when writing the storage back to disk.
+    m_tuForUrl.reserve(m_tuForUrl.size() + pins.size());
+    for (auto it = pins.constBegin(); it != pins.constEnd(); ++it) {
+        const IndexedString url(it.key());
+        // pins that got added before loading the storage are newer, keep them
+        if (!m_tuForUrl.contains(url)) {
+            m_tuForUrl.insert(url, IndexedString(it.value()));
+        }
+    }
+    QVector<IndexedString> indexedPaths;
+    indexedPaths.reserve(paths.size());
+    foreach (const auto& path, paths) {
+        indexedPaths.append(IndexedString(path));
+    }
+    for (auto it = includedFiles.constBegin(); it != includedFiles.constEnd(); ++it) {
+        const auto tu = indexedPaths.value(it.key());
+        // included files that got set before loading the storage are newer, keep them
+        if (tu.isEmpty() || m_includedFiles.contains(tu)) {
+            continue;
+        }
+        QVector<IndexedString> files;
+        files.reserve(it.value().size());
+        foreach (const auto path, it.value()) {
+            if (path < static_cast<quint32>(indexedPaths.size())) {
+                files.append(indexedPaths.at(path));
+            }
+        }
+        sortByIndex(&files);
+        m_includedFiles.insert(tu, files);
+    }
+    clangDebug() << "Loaded" << m_tuForUrl.size() << "pinned translation units and the included files of"
+                 << m_includedFiles.size() << "translation units from" << m_pinStoragePath;
+}
+
+void ClangIndex::savePins()
+{
+    if (m_pinStoragePath.isEmpty() || !m_pinsChanged) {
+        return;
+    }
+
+    QHash<QString, QString> pins;
+    pins.reserve(m_tuForUrl.size());
+    for (auto it = m_tuForUrl.constBegin(); it != m_tuForUrl.constEnd(); ++it) {
+        const auto url = it.key().str();
+        const auto tu = it.value().str();
+        if (!QFile::exists(url) || !QFile::exists(tu)) {
+            // file got removed, drop the pin
+            continue;
+        }
+        pins.insert(url, tu);
+    }
+
+    // every path is written once, the included files refer to it by its position in the table
+    QStringList paths;
+    QHash<IndexedString, quint32> pathIndices;
+    auto pathIndex = [&paths, &pathIndices] (const IndexedString& path) {
+        auto it = pathIndices.constFind(path);
+        if (it == pathIndices.constEnd()) {
+            it = pathIndices.insert(path, paths.size());
+            paths.append(path.str());
+        }
+        return it.value();
+    };
+
+    QHash<quint32, QVector<quint32>> includedFiles;
+    includedFiles.reserve(m_includedFiles.size());
+    for (auto it = m_includedFiles.begin(); it != m_includedFiles.end();) {
+        if (!QFile::exists(it.key().str())) {
+            // TU got removed, drop its included files
+            it = m_includedFiles.erase(it);
+            continue;
+        }
+        QVector<quint32> files;
+        files.reserve(it->size());
+        foreach (const auto& file, *it) {
+            files.append(pathIndex(file));
+        }
+        includedFiles.insert(pathIndex(it.key()), files);
+        ++it;
+    }
+
+    QSaveFile file(m_pinStoragePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(KDEV_CLANG) << "Failed to open" << m_pinStoragePath << "for writing the pinned translation units";
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << pinStorageVersion << pins << paths << includedFiles;
+    if (file.commit()) {
+        m_pinsChanged = false;
+    } else {
+        qCWarning(KDEV_CLANG) << "Failed to write the pinned translation units to" << m_pinStoragePath;
+    }
 }
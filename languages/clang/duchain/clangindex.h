@@ -22,14 +22,18 @@
 #ifndef CLANGINDEX_H
 #define CLANGINDEX_H
 
+#include "buddyfileindex.h"
 #include "clanghelpers.h"
+#include "sharedpreambles.h"
+#include "translationunitcache.h"
+#include "unsavedfilecache.h"
 
 #include "clangprivateexport.h"
 #include <serialization/indexedstring.h>
 
 #include <util/path.h>
 
-#include <QReadWriteLock>
+#include <QMutex>
 #include <QSharedPointer>
 
 #include <clang-c/Index.h>
@@ -46,11 +50,86 @@ public:
     CXIndex index() const;
 
     /**
-     * @returns the existing ClangPCH for the @param pchInclude
-     * The PCH is created using @param includePaths and @param defines if it doesn't exist
+     * @returns the ClangPCH for the pch include of @p environment
+     *
+     * The PCH is created for the given environment if it isn't cached or got outdated.
+     * Precompiled headers are cached in memory up to the configured budget, and on disk
+     * in the PCH cache directory for reuse across sessions.
      * This function is thread safe.
      */
-    QSharedPointer<const ClangPCH> pch(const ClangParsingEnvironment& defines);
+    QSharedPointer<const ClangPCH> pch(const ClangParsingEnvironment& environment);
+
+    /**
+     * Set the budget in bytes for the translation units of precompiled headers kept in memory
+     *
+     * When the budget is exceeded, the least recently used precompiled headers are evicted.
+     * Defaults to 512 MiB, which can be overridden in MiB via the KDEV_CLANG_PCH_CACHE_SIZE environment variable.
+     */
+    void setPchCacheBudget(quint64 bytes);
+
+    /**
+     * Set the directory the precompiled headers are written to
+     *
+     * An empty @p directory disables the on-disk cache.
+     */
+    void setPchCacheDirectory(const QString& directory);
+
+    /**
+     * Set the budget in bytes for the precompiled headers in the PCH cache directory
+     *
+     * When a new precompiled header is written and the budget is exceeded, the oldest files get removed,
+     * except for those of the precompiled headers in memory and those referenced via @ref referencePchFile.
+     * Defaults to 1 GiB, which can be overridden in MiB via the KDEV_CLANG_PCH_DISK_CACHE_SIZE environment variable.
+     */
+    void setPchDiskCacheBudget(quint64 bytes);
+
+    /**
+     * @return a reference to the precompiled header file at @p path, used by a translation unit via -include-pch
+     *
+     * The file is not evicted from the PCH cache directory while any reference to it is alive,
+     * even when its ClangPCH got evicted from memory.
+     * This function is thread safe.
+     */
+    QSharedPointer<const QString> referencePchFile(const QString& path);
+
+    /**
+     * @return the path of the precompiled header file for the pch include of @p environment,
+     *         or an empty string when the on-disk cache is disabled
+     */
+    QString pchCacheFile(const ClangParsingEnvironment& environment) const;
+
+    struct PchCacheStatistics
+    {
+        /// PCH found in memory
+        uint hits = 0;
+        /// PCH loaded from the on-disk cache
+        uint diskHits = 0;
+        /// PCH had to be created
+        uint misses = 0;
+        /// PCH evicted from memory due to the budget
+        uint evictions = 0;
+    };
+    PchCacheStatistics pchCacheStatistics() const;
+
+    /**
+     * @return the detector for leading includes shared by many translation units
+     */
+    SharedPreambles* sharedPreambles();
+
+    /**
+     * @return the on-disk cache of the translation units of closed documents
+     */
+    TranslationUnitCache* translationUnitCache();
+
+    /**
+     * @return the index of the header and source files of the open projects
+     */
+    BuddyFileIndex* buddyFileIndex();
+
+    /**
+     * @return the encoded contents of the modified documents, shared by the parse jobs and code completion
+     */
+    UnsavedFileCache* unsavedFileCache();
 
     /**
      * Gets the currently pinned TU for @p url
@@ -69,14 +148,70 @@ public:
      */
     void unpinTranslationUnitForUrl(const KDevelop::IndexedString& url);
 
+    /**
+     * Remember the @p files included by @p tu, directly or indirectly
+     *
+     * Only the files whose changes should trigger a reparse of @p tu need to be passed,
+     * i.e. no system headers.
+     */
+    void setIncludedFiles(const KDevelop::IndexedString& tu, const QVector<KDevelop::IndexedString>& files);
+
+    /**
+     * @return the translation units that include @p file, directly or indirectly, as of their last parse
+     */
+    QVector<KDevelop::IndexedString> dependentTranslationUnits(const KDevelop::IndexedString& file);
+
+    /**
+     * Persist the pinned translation units and the files included by translation units in the file at @p path
+     *
+     * They are loaded lazily on first access and written back when the index is destroyed.
+     * Without a storage path, they only live in memory.
+     */
+    void setPinStoragePath(const QString& path);
+
 private:
+    /// NOTE: m_mappingMutex must be locked when calling these
+    void ensurePinsLoaded();
+    void savePins();
+
+    /// NOTE: m_pchMutex must be locked when calling this
+    void evictPchs();
+    /// NOTE: m_pchMutex must not be locked when calling this, it accesses the file system
+    void evictPchFiles();
+
     CXIndex m_index;
 
-    QReadWriteLock m_pchLock;
-    QHash<KDevelop::Path, QSharedPointer<const ClangPCH>> m_pch;
+    struct PchCacheEntry
+    {
+        QSharedPointer<const ClangPCH> pch;
+        quint64 lastUsed;
+    };
+    /// key is the path of the pch include and the hash of the environment it was created for
+    using PchCacheKey = QPair<QString, uint>;
+
+    mutable QMutex m_pchMutex;
+    QHash<PchCacheKey, PchCacheEntry> m_pch;
+    quint64 m_pchUseCounter = 0;
+    quint64 m_pchCacheUsage = 0;
+    quint64 m_pchCacheBudget;
+    quint64 m_pchDiskCacheBudget;
+    QString m_pchCacheDirectory;
+    PchCacheStatistics m_pchStatistics;
+    /// the precompiled header files referenced by translation units, key is the path
+    QHash<QString, QWeakPointer<const QString>> m_pchFileReferences;
+
+    SharedPreambles m_sharedPreambles;
+    TranslationUnitCache m_translationUnitCache;
+    BuddyFileIndex m_buddyFileIndex;
+    UnsavedFileCache m_unsavedFileCache;
 
     QMutex m_mappingMutex;
     QHash<KDevelop::IndexedString, KDevelop::IndexedString> m_tuForUrl;
+    /// the files included by each translation unit, sorted by their index
+    QHash<KDevelop::IndexedString, QVector<KDevelop::IndexedString>> m_includedFiles;
+    QString m_pinStoragePath;
+    bool m_pinsLoaded = false;
+    bool m_pinsChanged = false;
 };
 
 #endif //CLANGINDEX_H
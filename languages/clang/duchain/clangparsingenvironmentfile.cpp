@@ -37,6 +37,7 @@ public:
         , environmentHash(0)
         , tuUrl()
         , quality(ClangParsingEnvironment::Unknown)
+        , contentFingerprint(0)
     {
     }
 
@@ -45,6 +46,7 @@ public:
         , environmentHash(rhs.environmentHash)
         , tuUrl(rhs.tuUrl)
         , quality(rhs.quality)
+        , contentFingerprint(rhs.contentFingerprint)
     {
     }
 
@@ -53,6 +55,8 @@ public:
     uint environmentHash;
     IndexedString tuUrl;
     ClangParsingEnvironment::Quality quality;
+    // NOTE: this changed the persisted layout of this class, DUChain caches written before must be cleared
+    uint contentFingerprint;
 };
 
 ClangParsingEnvironmentFile::ClangParsingEnvironmentFile(const IndexedString& url,
@@ -80,15 +84,7 @@ bool ClangParsingEnvironmentFile::needsUpdate(const ParsingEnvironment* environm
 {
     if (environment) {
         Q_ASSERT(dynamic_cast<const ClangParsingEnvironment*>(environment));
-        auto env = static_cast<const ClangParsingEnvironment*>(environment);
-        if (env->quality() > d_func()->quality) {
-            clangDebug() << "Found better quality environment, require update:" << url()
-                << "new environment quality:" << env->quality()
-                << "old environment quality:" << d_func()->quality;
-            return true;
-        }
-        if (env->translationUnitUrl() == d_func()->tuUrl && env->hash() != d_func()->environmentHash) {
-            clangDebug() << "TU environment changed, require update" << url() << "TU url:" << env->translationUnitUrl() << "old hash:" << d_func()->environmentHash << "new hash:" << env->hash();
+        if (needsEnvironmentUpdate(*static_cast<const ClangParsingEnvironment*>(environment))) {
             return true;
         }
     }
@@ -100,6 +96,21 @@ bool ClangParsingEnvironmentFile::needsUpdate(const ParsingEnvironment* environm
     return ret;
 }
 
+bool ClangParsingEnvironmentFile::needsEnvironmentUpdate(const ClangParsingEnvironment& environment) const
+{
+    if (environment.quality() > d_func()->quality) {
+        clangDebug() << "Found better quality environment, require update:" << url()
+            << "new environment quality:" << environment.quality()
+            << "old environment quality:" << d_func()->quality;
+        return true;
+    }
+    if (environment.translationUnitUrl() == d_func()->tuUrl && environment.hash() != d_func()->environmentHash) {
+        clangDebug() << "TU environment changed, require update" << url() << "TU url:" << environment.translationUnitUrl() << "old hash:" << d_func()->environmentHash << "new hash:" << environment.hash();
+        return true;
+    }
+    return false;
+}
+
 void ClangParsingEnvironmentFile::setEnvironment(const ClangParsingEnvironment& environment)
 {
     d_func_dynamic()->tuUrl = environment.translationUnitUrl();
@@ -122,4 +133,14 @@ uint ClangParsingEnvironmentFile::environmentHash() const
     return d_func()->environmentHash;
 }
 
+uint ClangParsingEnvironmentFile::contentFingerprint() const
+{
+    return d_func()->contentFingerprint;
+}
+
+void ClangParsingEnvironmentFile::setContentFingerprint(uint fingerprint)
+{
+    d_func_dynamic()->contentFingerprint = fingerprint;
+}
+
 DUCHAIN_DEFINE_TYPE(ClangParsingEnvironmentFile)
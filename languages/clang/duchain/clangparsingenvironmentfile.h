@@ -44,12 +44,23 @@ public:
 
     virtual bool matchEnvironment(const KDevelop::ParsingEnvironment* environment) const override;
 
+    /**
+     * @return true when the file needs to be updated for @p environment, ignoring the modification revisions
+     */
+    bool needsEnvironmentUpdate(const ClangParsingEnvironment& environment) const;
+
     void setEnvironment(const ClangParsingEnvironment& environment);
 
     ClangParsingEnvironment::Quality environmentQuality() const;
 
     uint environmentHash() const;
 
+    /**
+     * @return the fingerprint of the tokens the DUChain of this file was built from, or 0 if unknown
+     */
+    uint contentFingerprint() const;
+    void setContentFingerprint(uint fingerprint);
+
     enum {
         Identity = 142
     };
@@ -22,10 +22,18 @@
 
 #include <language/duchain/duchain.h>
 
+#include "astfiledependencies.h"
 #include "clanghelpers.h"
+#include "util/clangdebug.h"
 #include "util/clangtypes.h"
+#include "util/clangutils.h"
 #include "clangparsingenvironment.h"
 
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+
 using namespace KDevelop;
 
 namespace {
@@ -38,7 +46,7 @@ inline CXFile mapFile(CXFile file, CXTranslationUnit tu)
 
 }
 
-ClangPCH::ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index)
+ClangPCH::ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index, const QString& pchFile)
     : m_session({})
 {
     const auto& pchInclude = environment.pchInclude();
@@ -47,17 +55,52 @@ ClangPCH::ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index
     const TopDUContext::Features pchFeatures = TopDUContext::AllDeclarationsContextsUsesAndAST;
     const IndexedString doc(pchInclude.pathOrUrl());
 
-    ClangParsingEnvironment pchEnv;
+    // the PCH must be built with the same includes, defines and settings as the TUs using it
+    ClangParsingEnvironment pchEnv = environment;
     pchEnv.setPchInclude(Path());
     pchEnv.setTranslationUnitUrl(doc);
-    m_session.setData(ParseSessionData::Ptr(new ParseSessionData({}, index, pchEnv, ParseSessionData::PrecompiledHeader)));
+    // NOTE: the hash includes the pch include, so use the one of the original environment
+    const auto environmentHash = environment.hash();
+
+    if (!pchFile.isEmpty()) {
+        // try to reuse the PCH from a previous session
+        const auto dependencies = AstFileDependencies::read(pchFile, environmentHash);
+        if (AstFileDependencies::isUpToDate(dependencies)) {
+            m_session.setData(ParseSessionData::loadFromAstFile(pchFile, index, pchEnv));
+            if (m_session.unit()) {
+                m_dependencies = dependencies;
+                m_pchFile = pchFile;
+                m_loadedFromDisk = true;
+            }
+        }
+    }
 
     if (!m_session.unit()) {
-        return;
+        m_session.setData(ParseSessionData::Ptr(new ParseSessionData({}, index, pchEnv, ParseSessionData::PrecompiledHeader)));
+        if (!m_session.unit()) {
+            return;
+        }
+
+        m_dependencies = AstFileDependencies::collect(m_session.unit());
+        if (!pchFile.isEmpty()) {
+            const auto code = clang_saveTranslationUnit(m_session.unit(), QFile::encodeName(pchFile).constData(),
+                                                        CXSaveTranslationUnit_None);
+            if (code == CXSaveError_None && AstFileDependencies::write(pchFile, environmentHash, m_dependencies)) {
+                m_pchFile = pchFile;
+            } else {
+                qCWarning(KDEV_CLANG) << "Failed to save precompiled header" << pchInclude << "to" << pchFile;
+            }
+        }
+    }
+
+    m_dependencyPaths.reserve(m_dependencies.size());
+    for (const auto& dependency : m_dependencies) {
+        m_dependencyPaths.insert(QFileInfo(dependency.path).canonicalFilePath());
     }
 
     auto imports = ClangHelpers::tuImports(m_session.unit());
     m_context = ClangHelpers::buildDUChain(m_session.mainFile(), imports, m_session, pchFeatures, m_includes);
+    m_memoryUsage = ClangUtils::memoryUsage(m_session.unit());
 }
 
 IncludeFileContexts ClangPCH::mapIncludes(CXTranslationUnit tu) const
@@ -79,3 +122,35 @@ ReferencedTopDUContext ClangPCH::context() const
 {
     return m_context;
 }
+
+QString ClangPCH::pchFile() const
+{
+    return m_pchFile;
+}
+
+bool ClangPCH::isLoadedFromDisk() const
+{
+    return m_loadedFromDisk;
+}
+
+bool ClangPCH::isUpToDate() const
+{
+    return (m_pchFile.isEmpty() || QFile::exists(m_pchFile)) && AstFileDependencies::isUpToDate(m_dependencies);
+}
+
+bool ClangPCH::dependsOn(const UnsavedFile& unsavedFile) const
+{
+    return m_dependencyPaths.contains(QFileInfo(unsavedFile.fileName()).canonicalFilePath());
+}
+
+bool ClangPCH::dependsOnAnyOf(const QVector<UnsavedFile>& unsavedFiles) const
+{
+    return std::any_of(unsavedFiles.begin(), unsavedFiles.end(), [this] (const UnsavedFile& file) {
+        return dependsOn(file);
+    });
+}
+
+quint64 ClangPCH::memoryUsage() const
+{
+    return m_memoryUsage;
+}
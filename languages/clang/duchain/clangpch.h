@@ -24,6 +24,9 @@
 #include <language/duchain/topducontext.h>
 #include <util/path.h>
 
+#include <QSet>
+
+#include "astfiledependencies.h"
 #include "parsesession.h"
 #include "clanghelpers.h"
 
@@ -32,7 +35,13 @@ class ClangParsingEnvironment;
 class KDEVCLANGPRIVATE_EXPORT ClangPCH
 {
 public:
-    ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index);
+    /**
+     * Create the PCH for the pch include of @p environment
+     *
+     * If @p pchFile contains an up-to-date precompiled header for @p environment, it is loaded from there.
+     * Otherwise the pch include gets parsed and the result is saved to @p pchFile, if that is not empty.
+     */
+    ClangPCH(const ClangParsingEnvironment& environment, ClangIndex* index, const QString& pchFile);
 
     IncludeFileContexts mapIncludes(CXTranslationUnit tu) const;
 
@@ -40,12 +49,52 @@ public:
 
     KDevelop::ReferencedTopDUContext context() const;
 
+    /**
+     * @return the path to the precompiled header on disk, or an empty string if it could not be written
+     */
+    QString pchFile() const;
+
+    /**
+     * @return true when the precompiled header was loaded from disk instead of being parsed
+     */
+    bool isLoadedFromDisk() const;
+
+    /**
+     * @return false when any file that went into this PCH was changed or removed since it got created
+     */
+    bool isUpToDate() const;
+
+    /**
+     * @return true when @p unsavedFile went into this PCH
+     *
+     * clang rejects a precompiled header when one of its files is overridden by unsaved contents.
+     */
+    bool dependsOn(const UnsavedFile& unsavedFile) const;
+
+    /**
+     * @return true when any of the @p unsavedFiles went into this PCH
+     */
+    bool dependsOnAnyOf(const QVector<UnsavedFile>& unsavedFiles) const;
+
+    /**
+     * @return the memory used by the translation unit of this PCH in bytes
+     */
+    quint64 memoryUsage() const;
+
+    using Dependency = AstFileDependency;
+
 private:
     Q_DISABLE_COPY(ClangPCH);
 
     IncludeFileContexts m_includes;
     KDevelop::ReferencedTopDUContext m_context;
     ParseSession m_session;
+    QString m_pchFile;
+    QVector<Dependency> m_dependencies;
+    /// the canonical paths of m_dependencies
+    QSet<QString> m_dependencyPaths;
+    quint64 m_memoryUsage = 0;
+    bool m_loadedFromDisk = false;
 };
 
 #endif //CLANGPCH_H
@@ -157,6 +157,30 @@ ClangProblem::ClangProblem(CXDiagnostic diagnostic, CXTranslationUnit unit)
     setDiagnostics(diagnostics);
 }
 
+ClangProblem::ClangProblem(const ClangProblem& other)
+    : Problem()
+    , m_fixits(other.m_fixits)
+{
+    setSeverity(other.severity());
+    setDescription(other.description());
+    setExplanation(other.explanation());
+    setFinalLocation(other.finalLocation());
+    setSource(other.source());
+
+    QVector<IProblem::Ptr> diagnostics;
+    for (const IProblem::Ptr& diagnostic : other.diagnostics()) {
+        const Ptr problem(dynamic_cast<ClangProblem*>(diagnostic.data()));
+        Q_ASSERT(problem);
+        diagnostics << ProblemPointer(problem->clone().data());
+    }
+    setDiagnostics(diagnostics);
+}
+
+ClangProblem::Ptr ClangProblem::clone() const
+{
+    return Ptr(new ClangProblem(*this));
+}
+
 IAssistant::Ptr ClangProblem::solutionAssistant() const
 {
     if (allFixits().isEmpty()) {
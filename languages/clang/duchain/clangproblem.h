@@ -61,6 +61,13 @@ public:
      */
     ClangProblem(CXDiagnostic diagnostic, CXTranslationUnit unit);
 
+    /**
+     * @return a copy of this problem, including copies of its child diagnostics
+     *
+     * This is much cheaper than importing the same diagnostic again.
+     */
+    virtual Ptr clone() const;
+
     KDevelop::IAssistant::Ptr solutionAssistant() const override;
 
     ClangFixits fixits() const;
@@ -73,6 +80,9 @@ public:
      */
     ClangFixits allFixits() const;
 
+protected:
+    ClangProblem(const ClangProblem& other);
+
 private:
     ClangFixits m_fixits;
 };
@@ -21,6 +21,7 @@
 
 #include "documentfinderhelpers.h"
 
+#include "duchain/buddyfileindex.h"
 #include "duchain/clanghelpers.h"
 
 #include <language/duchain/duchain.h>
@@ -192,7 +193,7 @@ QStringList mimeTypesList()
     return mimeTypes;
 }
 
-bool areBuddies(const QUrl &url1, const QUrl& url2)
+bool areBuddies(const QUrl &url1, const QUrl& url2, const BuddyFileIndex* index)
 {
     auto type1 = basePathAndTypeForUrl(url1);
     auto type2 = basePathAndTypeForUrl(url2);
@@ -218,6 +219,11 @@ bool areBuddies(const QUrl &url1, const QUrl& url2)
         return true;
     }
 
+    // Then the project files in corresponding directories, e.g. src/ and include/
+    if (index && index->areBuddies(headerPath.toLocalFile(), sourcePath.toLocalFile())) {
+        return true;
+    }
+
     // Also check if the DUChain thinks this is likely
     if (duchainBuddyFile(sourcePath, Source) == headerPath) {
         return true;
@@ -234,7 +240,7 @@ bool buddyOrder(const QUrl &url1, const QUrl& url2)
     return(type1.second == Header && type2.second == Source);
 }
 
-QVector< QUrl > getPotentialBuddies(const QUrl &url, bool checkDUChain)
+QVector< QUrl > getPotentialBuddies(const QUrl &url, const BuddyFileIndex* index, bool checkDUChain)
 {
     auto type = basePathAndTypeForUrl(url);
     // Don't do anything for types we don't know
@@ -242,15 +248,25 @@ QVector< QUrl > getPotentialBuddies(const QUrl &url, bool checkDUChain)
         return {};
     }
 
-    // Depending on the buddy's file type we either generate source extensions (for headers)
-    // or header extensions (for sources)
-    const auto& extensions = ( type.second == Header ? ClangHelpers::sourceExtensions() : ClangHelpers::headerExtensions() );
     QVector< QUrl > buddies;
-    for(const QString& extension : extensions) {
-        if (!extension.contains(QLatin1Char('.'))) {
-            buddies.append(QUrl::fromLocalFile(type.first + QLatin1Char('.') + extension));
-        } else {
-            buddies.append(QUrl::fromLocalFile(type.first + extension));
+    const auto path = url.toLocalFile();
+    if (index && index->contains(path)) {
+        // project files know their existing buddies, no need to guess
+        foreach (const auto& buddy, index->buddies(path)) {
+            buddies.append(QUrl::fromLocalFile(buddy));
+        }
+    }
+    if (buddies.isEmpty()) {
+        // Also for project files whose buddies don't belong to any project.
+        // Depending on the buddy's file type we either generate source extensions (for headers)
+        // or header extensions (for sources)
+        const auto& extensions = ( type.second == Header ? ClangHelpers::sourceExtensions() : ClangHelpers::headerExtensions() );
+        for(const QString& extension : extensions) {
+            if (!extension.contains(QLatin1Char('.'))) {
+                buddies.append(QUrl::fromLocalFile(type.first + QLatin1Char('.') + extension));
+            } else {
+                buddies.append(QUrl::fromLocalFile(type.first + extension));
+            }
         }
     }
 
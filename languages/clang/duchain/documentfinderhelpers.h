@@ -29,6 +29,8 @@
 
 #include "clangprivateexport.h"
 
+class BuddyFileIndex;
+
 /// Helper class for handling @see IBuddyDocumentFinder features.
 namespace DocumentFinderHelpers
 {
@@ -39,14 +41,23 @@ KDEVCLANGPRIVATE_EXPORT QStringList mimeTypesList();
  * Considers the URLs as buddy documents if the base path (without extension)
  * is the same, and one extension starts with h/H and the other one with c/C.
  * For example, foo.hpp and foo.C are buddies.
+ *
+ * The project files in @p index are also buddies in corresponding directories, e.g. src/foo.cpp and include/foo.h.
  */
-KDEVCLANGPRIVATE_EXPORT bool areBuddies(const QUrl &url1, const QUrl& url2);
+KDEVCLANGPRIVATE_EXPORT bool areBuddies(const QUrl &url1, const QUrl& url2, const BuddyFileIndex* index = nullptr);
 
 /// @see KDevelop::IBuddyDocumentFinder
 KDEVCLANGPRIVATE_EXPORT bool buddyOrder(const QUrl &url1, const QUrl& url2);
 
-/// @see KDevelop::IBuddyDocumentFinder
-KDEVCLANGPRIVATE_EXPORT QVector< QUrl > getPotentialBuddies(const QUrl &url, bool checkDUChain = true);
+/**
+ * For the project files in @p index, these are their existing buddies.
+ * Otherwise, or when none of them is indexed, these are the paths with the same base name
+ * and all header or source extensions, which may not exist.
+ *
+ * @see KDevelop::IBuddyDocumentFinder
+ */
+KDEVCLANGPRIVATE_EXPORT QVector< QUrl > getPotentialBuddies(const QUrl &url, const BuddyFileIndex* index = nullptr,
+                                                            bool checkDUChain = true);
 };
 
 #endif // DOCUMENTFINDERHELPERS_H
@@ -0,0 +1,245 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "headernameindex.h"
+
+#include "clanghelpers.h"
+#include "../util/clangdebug.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <algorithm>
+
+using namespace KDevelop;
+
+namespace {
+
+/// the include directory itself and two levels of subdirectories
+const int maxDepth = 3;
+
+/// minimum time between two background updates of the index, in milliseconds
+const qint64 updateInterval = 2000;
+
+/**
+ * Scan @p path and, depending on @p depth, its subdirectories into @p directories
+ */
+void scanDirectory(const QString& path, int depth, QHash<QString, HeaderNameIndex::Directory>* directories)
+{
+    if (!depth || HeaderNameIndex::isBlacklisted(path)) {
+        return;
+    }
+
+    const QDir dir(path);
+    HeaderNameIndex::Directory directory;
+    directory.lastModified = QFileInfo(path).lastModified();
+    directory.depth = depth;
+    for (const auto& file : dir.entryList(QDir::Files)) {
+        // system headers sometimes don't have any extension, those can only be suggested when the name matches exactly
+        if (ClangHelpers::isHeader(file) || !file.contains(QLatin1Char('.'))) {
+            directory.headers.append({file, path + QLatin1Char('/') + file, file.toCaseFolded()});
+        }
+    }
+    if (depth > 1) {
+        directory.subdirectories = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    }
+    directories->insert(path, directory);
+
+    for (const auto& subdirectory : directory.subdirectories) {
+        scanDirectory(path + QLatin1Char('/') + subdirectory, depth - 1, directories);
+    }
+}
+
+/**
+ * Remove @p path and its scanned subdirectories from @p directories
+ */
+void removeDirectory(const QString& path, QHash<QString, HeaderNameIndex::Directory>* directories)
+{
+    const auto directory = directories->take(path);
+    for (const auto& subdirectory : directory.subdirectories) {
+        removeDirectory(path + QLatin1Char('/') + subdirectory, directories);
+    }
+}
+
+void sortHeaders(HeaderNameIndex::IncludeDirectory* includeDirectory)
+{
+    auto& headers = includeDirectory->headers;
+    headers.clear();
+    foreach (const auto& directory, includeDirectory->directories) {
+        headers += directory.headers;
+    }
+    std::sort(headers.begin(), headers.end(), [] (const HeaderNameIndex::Header& lhs, const HeaderNameIndex::Header& rhs) {
+        return lhs.key < rhs.key;
+    });
+}
+
+/**
+ * @return an updated copy of @p includeDirectory, or a null pointer when nothing changed
+ */
+QSharedPointer<HeaderNameIndex::IncludeDirectory> updatedIncludeDirectory(const HeaderNameIndex::IncludeDirectory& includeDirectory)
+{
+    QVector<QPair<QString, int>> changed;
+    for (auto it = includeDirectory.directories.constBegin(); it != includeDirectory.directories.constEnd(); ++it) {
+        if (QFileInfo(it.key()).lastModified() != it->lastModified) {
+            changed.append({it.key(), it->depth});
+        }
+    }
+    if (changed.isEmpty()) {
+        return {};
+    }
+
+    QSharedPointer<HeaderNameIndex::IncludeDirectory> updated(new HeaderNameIndex::IncludeDirectory(includeDirectory));
+    for (const auto& directory : changed) {
+        removeDirectory(directory.first, &updated->directories);
+        scanDirectory(directory.first, directory.second, &updated->directories);
+    }
+    sortHeaders(updated.data());
+    return updated;
+}
+
+class UpdateRunnable : public QRunnable
+{
+public:
+    explicit UpdateRunnable(HeaderNameIndex* index)
+        : m_index(index)
+    {
+    }
+
+    void run() override
+    {
+        m_index->update();
+    }
+
+private:
+    HeaderNameIndex* m_index;
+};
+
+}
+
+HeaderNameIndex::HeaderNameIndex()
+{
+    m_updatePool.setMaxThreadCount(1);
+}
+
+HeaderNameIndex::~HeaderNameIndex()
+{
+    m_updatePool.waitForDone();
+}
+
+bool HeaderNameIndex::isBlacklisted(const QString& path)
+{
+    if (ClangHelpers::isSource(path))
+        return true;
+
+    // Do not allow including directly from the bits directory.
+    // Instead use one of the forwarding headers in other directories, when possible.
+    if (path.contains( QLatin1String("bits") ) && path.contains(QLatin1String("/include/c++/")))
+        return true;
+
+    return false;
+}
+
+HeaderNameIndex* HeaderNameIndex::self()
+{
+    static HeaderNameIndex index;
+    return &index;
+}
+
+QStringList HeaderNameIndex::headersForIdentifier(const QString& identifier, const Path::List& includePaths)
+{
+    // e.g. QString is declared in qstring.h, so match case insensitively
+    const auto key = identifier.toCaseFolded();
+    QStringList candidates;
+    for (const auto& includePath : includePaths) {
+        const auto includeDirectory = this->includeDirectory(includePath.toLocalFile());
+        const auto& headers = includeDirectory->headers;
+        auto it = std::lower_bound(headers.begin(), headers.end(), key, [] (const Header& header, const QString& key) {
+            return header.key < key;
+        });
+        for (; it != headers.end() && it->key.startsWith(key); ++it) {
+            if (identifier.compare(it->fileName, Qt::CaseInsensitive) == 0 || ClangHelpers::isHeader(it->fileName)) {
+                clangDebug() << "Found candidate file" << it->path;
+                candidates.append(it->path);
+            }
+        }
+    }
+
+    scheduleUpdate();
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
+
+void HeaderNameIndex::update()
+{
+    QHash<QString, QSharedPointer<const IncludeDirectory>> includeDirectories;
+    {
+        QMutexLocker lock(&m_mutex);
+        includeDirectories = m_includeDirectories;
+    }
+
+    // stat the directories without holding the lock, lookups keep using the current index meanwhile
+    QHash<QString, QSharedPointer<const IncludeDirectory>> updatedDirectories;
+    for (auto it = includeDirectories.constBegin(); it != includeDirectories.constEnd(); ++it) {
+        if (auto updated = updatedIncludeDirectory(*it.value())) {
+            updatedDirectories.insert(it.key(), updated);
+        }
+    }
+
+    QMutexLocker lock(&m_mutex);
+    for (auto it = updatedDirectories.constBegin(); it != updatedDirectories.constEnd(); ++it) {
+        m_includeDirectories.insert(it.key(), it.value());
+    }
+    m_lastUpdate = QDateTime::currentMSecsSinceEpoch();
+    m_updating = false;
+}
+
+QSharedPointer<const HeaderNameIndex::IncludeDirectory> HeaderNameIndex::includeDirectory(const QString& path)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        auto includeDirectory = m_includeDirectories.value(path);
+        if (includeDirectory) {
+            return includeDirectory;
+        }
+    }
+
+    // the first lookup of an include directory has to scan it, later ones are answered from the index
+    QSharedPointer<IncludeDirectory> includeDirectory(new IncludeDirectory);
+    scanDirectory(path, maxDepth, &includeDirectory->directories);
+    sortHeaders(includeDirectory.data());
+
+    QMutexLocker lock(&m_mutex);
+    m_includeDirectories.insert(path, includeDirectory);
+    return includeDirectory;
+}
+
+void HeaderNameIndex::scheduleUpdate()
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_updating || QDateTime::currentMSecsSinceEpoch() - m_lastUpdate < updateInterval) {
+        return;
+    }
+    m_updating = true;
+    m_updatePool.start(new UpdateRunnable(this));
+}
@@ -0,0 +1,110 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef HEADERNAMEINDEX_H
+#define HEADERNAMEINDEX_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <util/path.h>
+
+#include "clangprivateexport.h"
+
+/**
+ * Index of the header file names below include directories, used to suggest includes for unknown declarations.
+ *
+ * Each include directory is scanned once, up to two levels of subdirectories. Afterwards the index is
+ * kept up to date in the background, by rescanning only the directories whose modification time changed.
+ */
+class KDEVCLANGPRIVATE_EXPORT HeaderNameIndex
+{
+public:
+    HeaderNameIndex();
+    ~HeaderNameIndex();
+
+    /**
+     * @return the index shared by all unknown declaration problems
+     */
+    static HeaderNameIndex* self();
+
+    /**
+     * @return the headers below @p includePaths whose file name starts with @p identifier, ignoring case, sorted and unique
+     *
+     * NOTE: This is thread safe.
+     */
+    QStringList headersForIdentifier(const QString& identifier, const KDevelop::Path::List& includePaths);
+
+    /**
+     * We don't want anything from the bits directory -
+     * we'd rather prefer forwarding includes, such as <vector>
+     *
+     * @return true when @p path should not be suggested for inclusion
+     */
+    static bool isBlacklisted(const QString& path);
+
+    /**
+     * Bring the index of all include directories up to date, blocking until done
+     */
+    void update();
+
+    struct Header
+    {
+        QString fileName;
+        QString path;
+        /// the case folded file name, which the headers are sorted by
+        QString key;
+    };
+
+    struct Directory
+    {
+        QDateTime lastModified;
+        /// the remaining depth for subdirectories, 1 means subdirectories are not scanned
+        int depth;
+        QVector<Header> headers;
+        QStringList subdirectories;
+    };
+
+    struct IncludeDirectory
+    {
+        QHash<QString, Directory> directories;
+        /// all headers of all directories, sorted by their key
+        QVector<Header> headers;
+    };
+
+private:
+    QSharedPointer<const IncludeDirectory> includeDirectory(const QString& path);
+    void scheduleUpdate();
+
+    QMutex m_mutex;
+    QHash<QString, QSharedPointer<const IncludeDirectory>> m_includeDirectories;
+    qint64 m_lastUpdate = 0;
+    bool m_updating = false;
+    QThreadPool m_updatePool;
+};
+
+Q_DECLARE_TYPEINFO(HeaderNameIndex::Header, Q_MOVABLE_TYPE);
+
+#endif // HEADERNAMEINDEX_H
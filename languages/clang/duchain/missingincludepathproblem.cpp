@@ -108,6 +108,11 @@ MissingIncludePathProblem::MissingIncludePathProblem(CXDiagnostic diagnostic, CX
     : ClangProblem(diagnostic, unit)
 {}
 
+ClangProblem::Ptr MissingIncludePathProblem::clone() const
+{
+    return ClangProblem::Ptr(new MissingIncludePathProblem(*this));
+}
+
 KDevelop::IAssistant::Ptr MissingIncludePathProblem::solutionAssistant() const
 {
     return KDevelop::IAssistant::Ptr(new MissingIncludePathAssistant(description(), finalLocation().document));
@@ -33,6 +33,8 @@ public:
 
     MissingIncludePathProblem(CXDiagnostic diagnostic, CXTranslationUnit unit);
 
+    ClangProblem::Ptr clone() const override;
+
     virtual KDevelop::IAssistant::Ptr solutionAssistant() const override;
 };
 
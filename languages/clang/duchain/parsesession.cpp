@@ -29,7 +29,9 @@
 #include "clanghelpers.h"
 #include "clangindex.h"
 #include "clangparsingenvironment.h"
+#include "clangpch.h"
 #include "util/clangdebug.h"
+#include "util/clangtrace.h"
 #include "util/clangtypes.h"
 #include "util/clangutils.h"
 
@@ -42,6 +44,8 @@
 #include <QFileInfo>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QMutexLocker>
+#include <QTemporaryFile>
 
 #include <algorithm>
 
@@ -65,10 +69,22 @@ QVector<QByteArray> extraArgs()
     return result;
 }
 
-QVector<QByteArray> argsForSession(const QString& path, ParseSessionData::Options options, const ParserSettings& parserSettings)
+bool isObjectiveC(const QString& path)
 {
+    static const QString objcMimeType = QStringLiteral("text/x-objcsrc");
+
     QMimeDatabase db;
-    if(db.mimeTypeForFile(path).name() == QStringLiteral("text/x-objcsrc")) {
+    // only look at the contents of the file when its name could denote Objective-C
+    const auto candidates = db.mimeTypesForFileName(path);
+    if (std::none_of(candidates.begin(), candidates.end(), [] (const QMimeType& type) { return type.name() == objcMimeType; })) {
+        return false;
+    }
+    return db.mimeTypeForFile(path).name() == objcMimeType;
+}
+
+QVector<QByteArray> argsForSession(bool isObjectiveC, ParseSessionData::Options options, const ParserSettings& parserSettings)
+{
+    if (isObjectiveC) {
         return {QByteArrayLiteral("-xobjective-c++")};
     }
 
@@ -95,14 +111,13 @@ QVector<QByteArray> argsForSession(const QString& path, ParseSessionData::Option
     return result;
 }
 
-void addIncludes(QVector<const char*>* args, QVector<QByteArray>* otherArgs,
-                 const Path::List& includes, const char* cliSwitch)
+void addIncludes(QVector<QByteArray>* args, const Path::List& includes, const char* cliSwitch)
 {
     foreach (const Path& url, includes) {
         if (url.isEmpty()) {
             continue;
         }
-        
+
         QFileInfo info(url.toLocalFile());
         QByteArray path = url.toLocalFile().toUtf8();
 
@@ -111,8 +126,7 @@ void addIncludes(QVector<const char*>* args, QVector<QByteArray>* otherArgs,
         } else {
             path.prepend(cliSwitch);
         }
-        otherArgs->append(path);
-        args->append(path.constData());
+        args->append(path);
     }
 }
 
@@ -143,6 +157,112 @@ bool hasQtIncludes(const Path::List& includePaths)
 
 }
 
+/**
+ * The clang arguments that follow from a parsing environment, shared by all translation units using it.
+ */
+struct EnvironmentArguments
+{
+    /// the language arguments, these must come before the PCH include
+    QVector<QByteArray> languageArguments;
+    /// compatibility headers, include paths and the defines file, these must come after the PCH include
+    QVector<QByteArray> includeArguments;
+    /// passed via -imacros, so it must exist as long as any translation unit parsed with it
+    QTemporaryFile definesFile;
+
+    // the input these arguments were created from, to not rely on the environment hash alone
+    ClangParsingEnvironment::IncludePaths includes;
+    QMap<QString, QString> defines;
+    ParserSettings parserSettings;
+};
+
+namespace {
+
+QSharedPointer<const EnvironmentArguments> createEnvironmentArguments(const ClangParsingEnvironment& environment,
+                                                                      bool isObjectiveC, ParseSessionData::Options options)
+{
+    QSharedPointer<EnvironmentArguments> arguments(new EnvironmentArguments);
+    arguments->includes = environment.includes();
+    arguments->defines = environment.defines();
+    arguments->parserSettings = environment.parserSettings();
+    arguments->languageArguments = argsForSession(isObjectiveC, options, arguments->parserSettings);
+
+    const auto& includes = arguments->includes;
+    auto& includeArguments = arguments->includeArguments;
+    includeArguments.reserve(includes.system.size() + includes.project.size() + 8);
+
+    if (needGccCompatibility(environment)) {
+        const auto compatFile = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QStringLiteral("kdevclangsupport/gcc_compat.h")).toUtf8();
+        if (!compatFile.isEmpty()) {
+            includeArguments << QByteArrayLiteral("-include") << compatFile;
+        }
+    }
+
+    if (hasQtIncludes(includes.system)) {
+        const auto wrappedQtHeaders = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+                                                             QStringLiteral("kdevclangsupport/wrappedQtHeaders"),
+                                                             QStandardPaths::LocateDirectory).toUtf8();
+        if (!wrappedQtHeaders.isEmpty()) {
+            includeArguments << QByteArrayLiteral("-isystem") << wrappedQtHeaders;
+            includeArguments << QByteArrayLiteral("-isystem") << wrappedQtHeaders + "/QtCore";
+        }
+    }
+
+    addIncludes(&includeArguments, includes.system, "-isystem");
+    addIncludes(&includeArguments, includes.project, "-I");
+
+    auto& definesFile = arguments->definesFile;
+    definesFile.open();
+    QTextStream definesStream(&definesFile);
+    Q_ASSERT(definesFile.isWritable());
+    const auto& defines = arguments->defines;
+    for (auto it = defines.begin(); it != defines.end(); ++it) {
+        if (it.key() == QLatin1String("__VERSION__") || it.key() == QLatin1String("__clang_minor__")
+            || it.key() == QLatin1String("__clang_patchlevel__") || it.key() == QLatin1String("__clang_version__"))
+        {
+            // don't emit tons of "macro redefined" errors for these macros
+            continue;
+        }
+        definesStream << QStringLiteral("#define ") << it.key() << ' ' << it.value() << '\n';
+    }
+    definesStream.flush();
+    includeArguments << QByteArrayLiteral("-imacros") << definesFile.fileName().toUtf8();
+
+    return arguments;
+}
+
+/**
+ * @return the arguments for @p environment, which are only created once for all translation units sharing it
+ */
+QSharedPointer<const EnvironmentArguments> environmentArguments(const ClangParsingEnvironment& environment,
+                                                                bool isObjectiveC, ParseSessionData::Options options)
+{
+    // the arguments are kept alive by the sessions using them, so just start over once there are too many
+    const int maxCachedEnvironments = 64;
+    static QMutex mutex;
+    static QHash<QPair<uint, int>, QSharedPointer<const EnvironmentArguments>> cache;
+
+    const int variant = (isObjectiveC ? 1 : 0) | (options.testFlag(ParseSessionData::PrecompiledHeader) ? 2 : 0);
+    const auto key = qMakePair(environment.hash(), variant);
+    const auto includes = environment.includes();
+
+    QMutexLocker lock(&mutex);
+    auto arguments = cache.value(key);
+    if (arguments && arguments->includes.system == includes.system && arguments->includes.project == includes.project
+        && arguments->defines == environment.defines() && arguments->parserSettings == environment.parserSettings())
+    {
+        return arguments;
+    }
+
+    arguments = createEnvironmentArguments(environment, isObjectiveC, options);
+    if (cache.size() >= maxCachedEnvironments) {
+        cache.clear();
+    }
+    cache.insert(key, arguments);
+    return arguments;
+}
+
+}
+
 ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, ClangIndex* index,
                                    const ClangParsingEnvironment& environment, Options options)
     : m_file(nullptr)
@@ -166,70 +286,43 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
     const auto tuUrl = environment.translationUnitUrl();
     Q_ASSERT(!tuUrl.isEmpty());
 
-    const auto arguments = argsForSession(tuUrl.str(), options, environment.parserSettings());
+    m_arguments = environmentArguments(environment, isObjectiveC(tuUrl.str()), options);
     QVector<const char*> clangArguments;
 
-    const auto& includes = environment.includes();
     const auto& pchInclude = environment.pchInclude();
 
     // uses QByteArray as smart-pointer for const char* ownership
     QVector<QByteArray> smartArgs;
-    smartArgs.reserve(includes.system.size() + includes.project.size()
-                      + pchInclude.isValid() + arguments.size() + 1);
-    clangArguments.reserve(smartArgs.size());
+    clangArguments.reserve(m_arguments->languageArguments.size() + m_arguments->includeArguments.size() + 2);
+
+    auto addArguments = [&clangArguments] (const QVector<QByteArray>& arguments) {
+        std::transform(arguments.constBegin(), arguments.constEnd(),
+                       std::back_inserter(clangArguments),
+                       [] (const QByteArray &argument) { return argument.constData(); });
+    };
 
-    std::transform(arguments.constBegin(), arguments.constEnd(),
-                   std::back_inserter(clangArguments),
-                   [] (const QByteArray &argument) { return argument.constData(); });
+    addArguments(m_arguments->languageArguments);
 
     // NOTE: the PCH include must come before all other includes!
     if (pchInclude.isValid()) {
-        clangArguments << "-include";
-        QByteArray pchFile = pchInclude.toLocalFile().toUtf8();
-        smartArgs << pchFile;
-        clangArguments << pchFile.constData();
-    }
-
-    if (needGccCompatibility(environment)) {
-        const auto compatFile = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QStringLiteral("kdevclangsupport/gcc_compat.h")).toUtf8();
-        if (!compatFile.isEmpty()) {
-            smartArgs << compatFile;
-            clangArguments << "-include" << compatFile.constData();
-        }
-    }
-
-    if (hasQtIncludes(includes.system)) {
-        const auto wrappedQtHeaders = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
-                                                             QStringLiteral("kdevclangsupport/wrappedQtHeaders"),
-                                                             QStandardPaths::LocateDirectory).toUtf8();
-        if (!wrappedQtHeaders.isEmpty()) {
-            smartArgs << wrappedQtHeaders;
-            clangArguments << "-isystem" << wrappedQtHeaders.constData();
-            const auto qtCore = wrappedQtHeaders + "/QtCore";
-            smartArgs << qtCore;
-            clangArguments << "-isystem" << qtCore.constData();
+        const auto pch = index->pch(environment);
+        m_pch = pch;
+        // clang rejects the PCH when one of its files is overridden, e.g. a header of a shared preamble
+        // that is being edited, so include the header directly until the edits are saved
+        const bool overridden = pch && !options.testFlag(PrecompiledHeader) && pch->dependsOnAnyOf(unsavedFiles);
+        if (pch && !pch->pchFile().isEmpty() && !overridden) {
+            m_pchFile = index->referencePchFile(pch->pchFile());
+            clangArguments << "-include-pch";
+            smartArgs << QFile::encodeName(*m_pchFile);
+        } else {
+            // fall back to including the header directly
+            clangArguments << "-include";
+            smartArgs << pchInclude.toLocalFile().toUtf8();
         }
+        clangArguments << smartArgs.last().constData();
     }
 
-    addIncludes(&clangArguments, &smartArgs, includes.system, "-isystem");
-    addIncludes(&clangArguments, &smartArgs, includes.project, "-I");
-
-    m_definesFile.open();
-    QTextStream definesStream(&m_definesFile);
-    Q_ASSERT(m_definesFile.isWritable());
-    const auto& defines = environment.defines();
-    for (auto it = defines.begin(); it != defines.end(); ++it) {
-        if (it.key() == QLatin1String("__VERSION__") || it.key() == QLatin1String("__clang_minor__")
-            || it.key() == QLatin1String("__clang_patchlevel__") || it.key() == QLatin1String("__clang_version__"))
-        {
-            // don't emit tons of "macro redefined" errors for these macros
-            continue;
-        }
-        definesStream << QStringLiteral("#define ") << it.key() << ' ' << it.value() << '\n';
-    }
-    definesStream.flush();
-    smartArgs << m_definesFile.fileName().toUtf8();
-    clangArguments << "-imacros" << smartArgs.last().constData();
+    addArguments(m_arguments->includeArguments);
 
     // append extra args from environment variable
     static const auto extraArgs = ::extraArgs();
@@ -241,6 +334,7 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
     //For PrecompiledHeader, we don't want unsaved contents (and contents.isEmpty())
     if (!options.testFlag(PrecompiledHeader)) {
         unsaved = toClangApi(unsavedFiles);
+        m_unsavedFiles = unsavedFiles;
     }
 
     // debugging: print hypothetical clang invocation including args (for easy c&p for local testing)
@@ -253,6 +347,7 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
         out << " " << tuUrl.byteArray().constData() << "\n";
     }
 
+    ClangTrace::Scope trace("clang_parseTranslationUnit2", tuUrl);
     const CXErrorCode code = clang_parseTranslationUnit2(
         index->index(), tuUrl.byteArray().constData(),
         clangArguments.constData(), clangArguments.size(),
@@ -270,15 +365,28 @@ ParseSessionData::ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, Cla
     if (m_unit) {
         setUnit(m_unit);
         m_environment = environment;
-
-        if (options.testFlag(PrecompiledHeader)) {
-            clang_saveTranslationUnit(m_unit, (tuUrl.byteArray() + ".pch").constData(), CXSaveTranslationUnit_None);
-        }
+        trace.setArgument("diagnostics", clang_getNumDiagnostics(m_unit));
     } else {
         qWarning() << "Failed to parse translation unit:" << tuUrl;
     }
 }
 
+ParseSessionData::Ptr ParseSessionData::loadFromAstFile(const QString& astFile, ClangIndex* index, const ClangParsingEnvironment& environment,
+                                                        const QSharedPointer<const QString>& pchFile)
+{
+    Ptr data(new ParseSessionData);
+    const CXErrorCode code = clang_createTranslationUnit2(index->index(), QFile::encodeName(astFile).constData(), &data->m_unit);
+    if (code != CXError_Success || !data->m_unit) {
+        clangDebug() << "clang_createTranslationUnit2 return with error code" << code << "for" << astFile;
+        return {};
+    }
+
+    data->setUnit(data->m_unit);
+    data->m_environment = environment;
+    data->m_pchFile = pchFile;
+    return data;
+}
+
 ParseSessionData::~ParseSessionData()
 {
     clang_disposeTranslationUnit(m_unit);
@@ -287,6 +395,16 @@ ParseSessionData::~ParseSessionData()
 void ParseSessionData::setUnit(CXTranslationUnit unit)
 {
     m_unit = unit;
+    {
+        QMutexLocker lock(&m_diagnosticsMutex);
+        m_diagnosticsGrouped = false;
+        if (!m_unit) {
+            m_problems.clear();
+            m_previousProblems.clear();
+        }
+    }
+    // computed once per (re-)parse, as other threads must not query the unit while it gets reparsed
+    m_memoryUsage = ClangUtils::memoryUsage(m_unit);
     if (m_unit) {
         const ClangString unitFile(clang_getTranslationUnitSpelling(unit));
         m_file = clang_getFile(m_unit, unitFile.c_str());
@@ -295,11 +413,75 @@ void ParseSessionData::setUnit(CXTranslationUnit unit)
     }
 }
 
+void ParseSessionData::groupDiagnostics()
+{
+    if (m_diagnosticsGrouped) {
+        return;
+    }
+    m_diagnosticsGrouped = true;
+
+    // only keep the problems of the previous unit that are still in use
+    m_previousProblems.swap(m_problems);
+    m_problems.clear();
+    m_diagnosticsByFile.clear();
+    m_includeFileNotFoundDiagnostics.clear();
+
+    const uint numDiagnostics = clang_getNumDiagnostics(m_unit);
+    for (uint i = 0; i < numDiagnostics; ++i) {
+        auto diagnostic = clang_getDiagnostic(m_unit, i);
+
+        CXFile diagnosticFile;
+        clang_getFileLocation(clang_getDiagnosticLocation(diagnostic), &diagnosticFile, nullptr, nullptr, nullptr);
+        m_diagnosticsByFile[diagnosticFile].append(i);
+
+        // checking the type requires the spelling, only do that for errors
+        if (clang_getDiagnosticSeverity(diagnostic) >= CXDiagnostic_Error
+            && ClangDiagnosticEvaluator::diagnosticType(diagnostic) == ClangDiagnosticEvaluator::IncludeFileNotFoundProblem)
+        {
+            m_includeFileNotFoundDiagnostics.append(i);
+        }
+
+        clang_disposeDiagnostic(diagnostic);
+    }
+}
+
+ProblemPointer ParseSessionData::problemForDiagnostic(uint index)
+{
+    auto diagnostic = clang_getDiagnostic(m_unit, index);
+
+    // the formatted diagnostics contain the location, severity, spelling and option
+    const auto displayOptions = clang_defaultDiagnosticDisplayOptions();
+    auto key = ClangString(clang_formatDiagnostic(diagnostic, displayOptions)).toByteArray();
+    auto childDiagnostics = clang_getChildDiagnostics(diagnostic);
+    const uint numChildDiagnostics = clang_getNumDiagnosticsInSet(childDiagnostics);
+    for (uint i = 0; i < numChildDiagnostics; ++i) {
+        key += '\n';
+        key += ClangString(clang_formatDiagnostic(clang_getDiagnosticInSet(childDiagnostics, i), displayOptions)).toByteArray();
+    }
+    auto problem = m_problems.value(key);
+    if (!problem) {
+        problem = m_previousProblems.value(key);
+        if (!problem) {
+            problem = ClangProblem::Ptr(ClangDiagnosticEvaluator::createProblem(diagnostic, m_unit));
+        }
+        m_problems.insert(key, problem);
+    }
+
+    clang_disposeDiagnostic(diagnostic);
+    // hand out copies, the problems are owned by the contexts they get stored in
+    return ProblemPointer(problem->clone().data());
+}
+
 ClangParsingEnvironment ParseSessionData::environment() const
 {
     return m_environment;
 }
 
+quint64 ParseSessionData::memoryUsage() const
+{
+    return m_memoryUsage;
+}
+
 ParseSession::ParseSession(const ParseSessionData::Ptr& data)
     : d(data)
 {
@@ -345,45 +527,45 @@ IndexedString ParseSession::languageString()
     return lang;
 }
 
-QList<ProblemPointer> ParseSession::problemsForFile(CXFile file) const
+QList<ProblemPointer> ParseSession::problemsForFile(CXFile file, TodoExtraction todos) const
 {
     if (!d) {
         return {};
     }
 
+    ClangTrace::Scope trace("ParseSession::problemsForFile", file);
     QList<ProblemPointer> problems;
 
     // extra clang diagnostics
-    const uint numDiagnostics = clang_getNumDiagnostics(d->m_unit);
-    problems.reserve(numDiagnostics);
-    for (uint i = 0; i < numDiagnostics; ++i) {
-        auto diagnostic = clang_getDiagnostic(d->m_unit, i);
+    {
+        QMutexLocker lock(&d->m_diagnosticsMutex);
+        d->groupDiagnostics();
 
-        CXSourceLocation location = clang_getDiagnosticLocation(diagnostic);
-        CXFile diagnosticFile;
-        clang_getFileLocation(location, &diagnosticFile, nullptr, nullptr, nullptr);
         // missing-include problems are so severe in clang that we always propagate
         // them to this document, to ensure that the user will see the error.
-        if (diagnosticFile != file && ClangDiagnosticEvaluator::diagnosticType(diagnostic) != ClangDiagnosticEvaluator::IncludeFileNotFoundProblem) {
-            continue;
-        }
-
-        ProblemPointer problem(ClangDiagnosticEvaluator::createProblem(diagnostic, d->m_unit));
-        problems << problem;
+        auto diagnostics = d->m_diagnosticsByFile.value(file) + d->m_includeFileNotFoundDiagnostics;
+        std::sort(diagnostics.begin(), diagnostics.end());
+        diagnostics.erase(std::unique(diagnostics.begin(), diagnostics.end()), diagnostics.end());
 
-        clang_disposeDiagnostic(diagnostic);
+        problems.reserve(diagnostics.size());
+        foreach (uint i, diagnostics) {
+            problems << d->problemForDiagnostic(i);
+        }
     }
 
     // other problem sources
 
-    TodoExtractor extractor(unit(), file);
-    problems << extractor.problems();
+    const QString path = QDir(ClangString(clang_getFileName(file)).toString()).canonicalPath();
+    const IndexedString indexedPath(path);
+
+    if (todos == ExtractTodos) {
+        TodoExtractor extractor(fileContents(file), indexedPath);
+        problems << extractor.problems();
+    }
 
 #if CINDEX_VERSION_MINOR > 30
     // note that the below warning is triggered on every reparse when there is a precompiled preamble
     // see also TestDUChain::testReparseIncludeGuard
-    const QString path = QDir(ClangString(clang_getFileName(file)).toString()).canonicalPath();
-    const IndexedString indexedPath(path);
     if (ClangHelpers::isHeader(path) && !clang_isFileMultipleIncludeGuarded(unit(), file)
         && !clang_Location_isInSystemHeader(clang_getLocationForOffset(d->m_unit, file, 0)))
     {
@@ -399,9 +581,37 @@ QList<ProblemPointer> ParseSession::problemsForFile(CXFile file) const
     }
 #endif
 
+    trace.setArgument("problems", problems.size());
     return problems;
 }
 
+QByteArray ParseSession::fileContents(CXFile file) const
+{
+    if (!d) {
+        return {};
+    }
+
+#if CINDEX_VERSION_MINOR >= 47
+    size_t size = 0;
+    const char* contents = clang_getFileContents(d->m_unit, file, &size);
+    // the buffer is owned by the translation unit, which outlives the returned data while we hold the session
+    return QByteArray::fromRawData(contents, size);
+#else
+    const QString fileName = ClangString(clang_getFileName(file)).toString();
+    foreach (const auto& unsavedFile, d->m_unsavedFiles) {
+        if (unsavedFile.fileName() == fileName) {
+            return unsavedFile.contents();
+        }
+    }
+
+    QFile diskFile(fileName);
+    if (!diskFile.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return diskFile.readAll();
+#endif
+}
+
 CXTranslationUnit ParseSession::unit() const
 {
     return d ? d->m_unit : nullptr;
@@ -423,8 +633,17 @@ bool ParseSession::reparse(const QVector<UnsavedFile>& unsavedFiles, const Clang
         return false;
     }
 
+    if (d->m_pchFile) {
+        // the unit must be recreated to include the pch include directly when one of its files gets overridden
+        const auto pch = d->m_pch.toStrongRef();
+        if (pch ? pch->dependsOnAnyOf(unsavedFiles) : !unsavedFiles.isEmpty()) {
+            return false;
+        }
+    }
+
     auto unsaved = toClangApi(unsavedFiles);
 
+    ClangTrace::Scope trace("clang_reparseTranslationUnit", environment.translationUnitUrl());
     const auto code = clang_reparseTranslationUnit(d->m_unit, unsaved.size(), unsaved.data(),
                                                    clang_defaultReparseOptions(d->m_unit));
     if (code != CXError_Success) {
@@ -436,7 +655,9 @@ bool ParseSession::reparse(const QVector<UnsavedFile>& unsavedFiles, const Clang
     }
 
     // update state
+    d->m_unsavedFiles = unsavedFiles;
     d->setUnit(d->m_unit);
+    trace.setArgument("diagnostics", clang_getNumDiagnostics(d->m_unit));
     return true;
 }
 
@@ -444,3 +665,18 @@ ClangParsingEnvironment ParseSession::environment() const
 {
     return d->m_environment;
 }
+
+QSharedPointer<const ClangPCH> ParseSession::pch() const
+{
+    return d->m_pch.toStrongRef();
+}
+
+QString ParseSession::pchFile() const
+{
+    return d->m_pchFile ? *d->m_pchFile : QString();
+}
+
+QVector<UnsavedFile> ParseSession::unsavedFiles() const
+{
+    return d->m_unsavedFiles;
+}
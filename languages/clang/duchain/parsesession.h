@@ -23,12 +23,15 @@
 #ifndef PARSESESSION_H
 #define PARSESESSION_H
 
+#include <QHash>
 #include <QList>
+#include <QSharedPointer>
 #include <QUrl>
-#include <QTemporaryFile>
 
 #include <clang-c/Index.h>
 
+#include <atomic>
+
 #include <serialization/indexedstring.h>
 
 #include <util/path.h>
@@ -42,6 +45,9 @@
 #include "unsavedfile.h"
 
 class ClangIndex;
+class ClangPCH;
+class ClangProblem;
+struct EnvironmentArguments;
 
 class KDEVCLANGPRIVATE_EXPORT ParseSessionData : public KDevelop::IAstContainer
 {
@@ -63,23 +69,76 @@ public:
     ParseSessionData(const QVector<UnsavedFile>& unsavedFiles, ClangIndex* index,
                      const ClangParsingEnvironment& environment, Options options = Options());
 
+    /**
+     * Load the translation unit from the AST file @p astFile, as written by clang_saveTranslationUnit.
+     *
+     * @param pchFile The reference to the precompiled header file the unit was parsed with, if any,
+     *                see ClangIndex::referencePchFile
+     * @return the new session data, or a null pointer if the file could not be loaded
+     */
+    static Ptr loadFromAstFile(const QString& astFile, ClangIndex* index, const ClangParsingEnvironment& environment,
+                               const QSharedPointer<const QString>& pchFile = {});
+
     ~ParseSessionData();
 
     ClangParsingEnvironment environment() const;
 
+    /**
+     * @return the memory used by the translation unit in bytes, as of its last (re-)parse
+     *
+     * NOTE: This is thread safe.
+     */
+    quint64 memoryUsage() const;
+
 private:
     friend class ParseSession;
 
+    ParseSessionData() = default;
+
     void setUnit(CXTranslationUnit unit);
 
+    /**
+     * Group the diagnostics of the translation unit by their file, once per (re-)parse
+     *
+     * NOTE: m_diagnosticsMutex must be locked
+     */
+    void groupDiagnostics();
+
+    /**
+     * @return the problem for the diagnostic at @p index, copied from the problem created
+     *         for an identical diagnostic of this or the previous unit if possible
+     *
+     * NOTE: m_diagnosticsMutex must be locked
+     */
+    KDevelop::ProblemPointer problemForDiagnostic(uint index);
+
     QMutex m_mutex;
 
     CXFile m_file = nullptr;
     CXTranslationUnit m_unit = nullptr;
+    std::atomic<quint64> m_memoryUsage{0};
     ClangParsingEnvironment m_environment;
-    /// TODO: share this file for all TUs that use the same defines (probably most in a project)
-    ///       best would be a PCH, if possible
-    QTemporaryFile m_definesFile;
+    /// the arguments shared with all other sessions of the same environment, including the defines file
+    QSharedPointer<const EnvironmentArguments> m_arguments;
+    /// the unsaved contents of the last (re-)parse, to look up file contents on older libclang versions
+    QVector<UnsavedFile> m_unsavedFiles;
+    /// the precompiled header the unit got parsed with, not kept alive past its eviction from the index
+    QWeakPointer<const ClangPCH> m_pch;
+    /// the precompiled header file passed via -include-pch, null when the pch include is included directly.
+    /// Keeps the file from being evicted from the PCH cache directory while the unit may be reparsed against it
+    QSharedPointer<const QString> m_pchFile;
+
+    /// protects the diagnostics below, problems may be requested from multiple threads building the DUChain
+    QMutex m_diagnosticsMutex;
+    bool m_diagnosticsGrouped = false;
+    /// indices of the diagnostics of the translation unit, grouped by the file they are located in
+    QHash<CXFile, QVector<uint>> m_diagnosticsByFile;
+    /// indices of the diagnostics about missing include files, those are reported for every file
+    QVector<uint> m_includeFileNotFoundDiagnostics;
+    /// the problems created for diagnostics of the current unit, keyed by the formatted diagnostic
+    QHash<QByteArray, QExplicitlySharedDataPointer<ClangProblem>> m_problems;
+    /// the problems created for diagnostics of the previous unit, reused when the diagnostic did not change
+    QHash<QByteArray, QExplicitlySharedDataPointer<ClangProblem>> m_previousProblems;
 };
 
 /**
@@ -121,7 +180,21 @@ public:
      */
     CXFile mainFile() const;
 
-    QList<KDevelop::ProblemPointer> problemsForFile(CXFile file) const;
+    enum TodoExtraction {
+        ExtractTodos,
+        /// do not look for to-do comments, e.g. when the file did not change since they were extracted
+        SkipTodos
+    };
+
+    QList<KDevelop::ProblemPointer> problemsForFile(CXFile file, TodoExtraction todos = ExtractTodos) const;
+
+    /**
+     * @return the contents of @p file as seen by clang, including unsaved editor contents
+     *
+     * NOTE: The returned data may reference memory of the translation unit, don't use it after
+     *       the session data got changed or released.
+     */
+    QByteArray fileContents(CXFile file) const;
 
     CXTranslationUnit unit() const;
 
@@ -129,6 +202,23 @@ public:
 
     ClangParsingEnvironment environment() const;
 
+    /**
+     * @return the precompiled header the translation unit was parsed with,
+     *         or a null pointer when there is none or it got evicted from the index meanwhile
+     */
+    QSharedPointer<const ClangPCH> pch() const;
+
+    /**
+     * @return the precompiled header file the translation unit was parsed with via -include-pch,
+     *         or an empty string when the pch include was included directly
+     */
+    QString pchFile() const;
+
+    /**
+     * @return the unsaved editor contents the translation unit was (re-)parsed with
+     */
+    QVector<UnsavedFile> unsavedFiles() const;
+
 private:
     Q_DISABLE_COPY(ParseSession);
 
@@ -0,0 +1,278 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "sharedpreambles.h"
+
+#include "util/clangdebug.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+
+using namespace KDevelop;
+
+namespace {
+
+const QByteArray headerComment = QByteArrayLiteral("// Shared preamble generated by KDevelop, do not edit\n");
+const QByteArray includePrefix = QByteArrayLiteral("#include \"");
+const QByteArray spellingSeparator = QByteArrayLiteral("\" // ");
+
+bool isSameInclude(const SharedPreambles::Include& lhs, const SharedPreambles::Include& rhs)
+{
+    return lhs.spelling == rhs.spelling && lhs.path == rhs.path;
+}
+
+int commonPrefixLength(const QVector<SharedPreambles::Include>& lhs, const QVector<SharedPreambles::Include>& rhs)
+{
+    const auto end = lhs.begin() + std::min(lhs.size(), rhs.size());
+    return std::mismatch(lhs.begin(), end, rhs.begin(), isSameInclude).first - lhs.begin();
+}
+
+bool isQuoted(const QByteArray& spelling)
+{
+    return spelling.startsWith('"');
+}
+
+/**
+ * @return the file a quoted include @p spelling would be resolved to relative to the directory @p dir
+ */
+QFileInfo relativeInclude(const QDir& dir, const QByteArray& spelling)
+{
+    return QFileInfo(dir, QString::fromUtf8(spelling.mid(1, spelling.size() - 2)));
+}
+
+/**
+ * Reads back the includes of a header written by SharedPreambles::writeHeader
+ */
+QVector<SharedPreambles::Include> readHeader(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.readLine() != headerComment) {
+        return {};
+    }
+
+    QVector<SharedPreambles::Include> includes;
+    while (!file.atEnd()) {
+        const auto line = file.readLine().trimmed();
+        const int separator = line.indexOf(spellingSeparator);
+        if (!line.startsWith(includePrefix) || separator == -1) {
+            clangDebug() << "Ignoring malformed shared preamble" << path;
+            return {};
+        }
+        const auto includePath = line.mid(includePrefix.size(), separator - includePrefix.size());
+        includes.append({line.mid(separator + spellingSeparator.size()), -1, IndexedString(QString::fromUtf8(includePath))});
+    }
+    return includes;
+}
+
+QByteArray readFileStart(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    // the leading includes are at the start of the file, don't read more than we need
+    return file.read(64 * 1024);
+}
+
+}
+
+SharedPreambles::SharedPreambles(const QString& directory)
+    : m_directory(directory)
+{
+}
+
+QVector<SharedPreambles::Include> SharedPreambles::leadingIncludes(const QByteArray& contents)
+{
+    QVector<Include> includes;
+
+    bool inComment = false;
+    int line = 0;
+    int start = 0;
+    while (start < contents.size()) {
+        int end = contents.indexOf('\n', start);
+        if (end == -1) {
+            end = contents.size();
+        }
+        auto text = contents.mid(start, end - start).trimmed();
+        const int currentLine = line++;
+        start = end + 1;
+
+        if (inComment) {
+            const int commentEnd = text.indexOf("*/");
+            if (commentEnd == -1) {
+                continue;
+            }
+            inComment = false;
+            text = text.mid(commentEnd + 2).trimmed();
+        }
+        if (text.startsWith("/*")) {
+            const int commentEnd = text.indexOf("*/", 2);
+            if (commentEnd == -1) {
+                inComment = true;
+                continue;
+            }
+            text = text.mid(commentEnd + 2).trimmed();
+        }
+        if (text.isEmpty() || text.startsWith("//")) {
+            continue;
+        }
+
+        // anything but a plain #include ends the preamble
+        if (!text.startsWith('#')) {
+            break;
+        }
+        text = text.mid(1).trimmed();
+        if (!text.startsWith("include")) {
+            break;
+        }
+        text = text.mid(7).trimmed();
+        const char delimiter = text.startsWith('<') ? '>' : text.startsWith('"') ? '"' : 0;
+        const int delimiterEnd = delimiter ? text.indexOf(delimiter, 1) : -1;
+        if (delimiterEnd == -1) {
+            // e.g. #include_next or an include via macro
+            break;
+        }
+        includes.append({text.left(delimiterEnd + 1), currentLine, {}});
+    }
+
+    return includes;
+}
+
+void SharedPreambles::addTranslationUnit(uint environmentHash, const IndexedString& tu, const QVector<Include>& includes)
+{
+    // quoted includes that are found relative to the translation unit can't be shared with others
+    const QDir tuDir = QFileInfo(tu.str()).dir();
+    auto it = std::find_if(includes.begin(), includes.end(), [&tuDir] (const Include& include) {
+        return include.path.isEmpty() || (isQuoted(include.spelling) && relativeInclude(tuDir, include.spelling).exists());
+    });
+    const int shareable = it - includes.begin();
+    if (shareable < minimumIncludes) {
+        return;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    auto candidate = this->candidate(environmentHash);
+    if (candidate->header.isValid() || candidate->translationUnits.contains(tu)) {
+        return;
+    }
+
+    const int common = commonPrefixLength(candidate->includes, includes.mid(0, shareable));
+    if (common < minimumIncludes) {
+        if (candidate->translationUnits.size() <= 1) {
+            // the previous translation unit might have been the odd one out, start over with this one
+            candidate->includes = includes.mid(0, shareable);
+            candidate->translationUnits = {tu};
+        }
+        return;
+    }
+
+    candidate->includes.resize(common);
+    candidate->translationUnits.insert(tu);
+    if (candidate->translationUnits.size() >= minimumTranslationUnits) {
+        writeHeader(environmentHash, candidate);
+    }
+}
+
+Path SharedPreambles::preambleForTranslationUnit(uint environmentHash, const IndexedString& tu)
+{
+    return preambleForTranslationUnit(environmentHash, tu, readFileStart(tu.str()));
+}
+
+Path SharedPreambles::preambleForTranslationUnit(uint environmentHash, const IndexedString& tu, const QByteArray& contents)
+{
+    QVector<Include> preamble;
+    Path header;
+    {
+        QMutexLocker lock(&m_mutex);
+        auto candidate = this->candidate(environmentHash);
+        if (!candidate->header.isValid()) {
+            return {};
+        }
+        preamble = candidate->includes;
+        header = candidate->header;
+    }
+
+    const auto includes = leadingIncludes(contents);
+    if (includes.size() < preamble.size()) {
+        return {};
+    }
+
+    const QDir tuDir = QFileInfo(tu.str()).dir();
+    for (int i = 0; i < preamble.size(); ++i) {
+        const auto& spelling = includes[i].spelling;
+        if (spelling != preamble[i].spelling
+            || (isQuoted(spelling) && relativeInclude(tuDir, spelling).exists()))
+        {
+            return {};
+        }
+    }
+
+    return header;
+}
+
+SharedPreambles::Candidate* SharedPreambles::candidate(uint environmentHash)
+{
+    auto it = m_candidates.find(environmentHash);
+    if (it == m_candidates.end()) {
+        it = m_candidates.insert(environmentHash, {});
+        // reuse the header generated in a previous session
+        const auto path = headerPath(environmentHash);
+        const auto includes = readHeader(path);
+        if (!includes.isEmpty()) {
+            it->includes = includes;
+            it->header = Path(path);
+        }
+    }
+    return &it.value();
+}
+
+void SharedPreambles::writeHeader(uint environmentHash, Candidate* candidate)
+{
+    if (!QDir().mkpath(m_directory)) {
+        return;
+    }
+
+    const auto path = headerPath(environmentHash);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(KDEV_CLANG) << "Failed to write shared preamble" << path;
+        return;
+    }
+
+    file.write(headerComment);
+    for (const auto& include : candidate->includes) {
+        file.write(includePrefix + include.path.byteArray() + spellingSeparator + include.spelling + '\n');
+    }
+
+    if (file.commit()) {
+        clangDebug() << "Generated shared preamble" << path << "with" << candidate->includes.size() << "includes"
+                     << "shared by" << candidate->translationUnits.size() << "translation units";
+        candidate->header = Path(path);
+        candidate->translationUnits.clear();
+    }
+}
+
+QString SharedPreambles::headerPath(uint environmentHash) const
+{
+    return m_directory + QStringLiteral("/preamble-") + QString::number(environmentHash) + QStringLiteral(".h");
+}
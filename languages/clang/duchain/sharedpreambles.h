@@ -0,0 +1,113 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef SHAREDPREAMBLES_H
+#define SHAREDPREAMBLES_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
+
+#include <serialization/indexedstring.h>
+#include <util/path.h>
+
+#include "clangprivateexport.h"
+
+/**
+ * Detects the leading includes shared by many translation units with the same environment.
+ *
+ * Once enough translation units start with the same includes, a header that includes
+ * all of them is generated. It can then be used as PCH include for all translation units
+ * that start with these includes, such that the shared headers only get parsed once.
+ *
+ * This class is thread safe.
+ */
+class KDEVCLANGPRIVATE_EXPORT SharedPreambles
+{
+public:
+    struct Include
+    {
+        /// the include as written in the source, including the delimiters, e.g. "<vector>"
+        QByteArray spelling;
+        /// the 0-based line of the include directive
+        int line;
+        /// the resolved path of the included file
+        KDevelop::IndexedString path;
+    };
+
+    /**
+     * @param directory The directory where the generated headers are stored
+     */
+    explicit SharedPreambles(const QString& directory);
+
+    /**
+     * @return the #include directives at the start of @p contents, i.e. before any code or other directive
+     *
+     * The returned includes are not resolved, i.e. their path is empty.
+     */
+    static QVector<Include> leadingIncludes(const QByteArray& contents);
+
+    /**
+     * Record the resolved leading @p includes of the translation unit @p tu, parsed with
+     * an environment hashing to @p environmentHash and without PCH include.
+     */
+    void addTranslationUnit(uint environmentHash, const KDevelop::IndexedString& tu, const QVector<Include>& includes);
+
+    /**
+     * @return the generated header for the shared preamble of @p tu, or an invalid path if there is none
+     *
+     * The header is only returned if @p tu starts with the includes of the shared preamble.
+     * Its contents are read from disk, use the overload below for translation units with unsaved contents.
+     */
+    KDevelop::Path preambleForTranslationUnit(uint environmentHash, const KDevelop::IndexedString& tu);
+
+    /**
+     * @return the generated header for the shared preamble of @p tu, matched against its @p contents
+     */
+    KDevelop::Path preambleForTranslationUnit(uint environmentHash, const KDevelop::IndexedString& tu,
+                                              const QByteArray& contents);
+
+    /// Minimal number of translation units that need to share a preamble
+    static const int minimumTranslationUnits = 8;
+    /// Minimal number of includes in a shared preamble
+    static const int minimumIncludes = 3;
+
+private:
+    struct Candidate
+    {
+        QVector<Include> includes;
+        QSet<KDevelop::IndexedString> translationUnits;
+        KDevelop::Path header;
+    };
+
+    /// NOTE: m_mutex must be locked when calling these
+    Candidate* candidate(uint environmentHash);
+    void writeHeader(uint environmentHash, Candidate* candidate);
+
+    QString headerPath(uint environmentHash) const;
+
+    QMutex m_mutex;
+    QString m_directory;
+    QHash<uint, Candidate> m_candidates;
+};
+
+Q_DECLARE_TYPEINFO(SharedPreambles::Include, Q_MOVABLE_TYPE);
+
+#endif // SHAREDPREAMBLES_H
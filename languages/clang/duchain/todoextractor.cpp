@@ -21,8 +21,6 @@
 
 #include "todoextractor.h"
 
-#include "../util/clangtypes.h"
-
 #include <language/duchain/problem.h>
 #include <language/duchain/stringhelpers.h>
 #include <interfaces/icore.h>
@@ -30,10 +28,8 @@
 #include <interfaces/icompletionsettings.h>
 
 #include <QStringList>
-#include <QDir>
 
 #include <algorithm>
-#include <limits>
 
 using namespace KDevelop;
 
@@ -148,61 +144,232 @@ private:
     QVector<Result> m_results;
 };
 
+inline bool isIdentifierCharacter(QChar c)
+{
+    return c.isLetterOrNumber() || c == QLatin1Char('_');
 }
 
-TodoExtractor::TodoExtractor(CXTranslationUnit unit, CXFile file)
-    : m_unit(unit)
-    , m_file(file)
-    , m_todoMarkerWords(KDevelop::ICore::self()->languageController()->completionSettings()->todoMarkerWords())
+/**
+ * @return true when the single quote at @p it separates the digits of a number literal, as in 1'000
+ */
+bool isDigitSeparator(const QChar* begin, const QChar* it)
 {
-    extractTodos();
+    auto tokenStart = it;
+    while (tokenStart != begin && (isIdentifierCharacter(*(tokenStart - 1)) || *(tokenStart - 1) == QLatin1Char('.'))) {
+        --tokenStart;
+    }
+    return tokenStart != it && tokenStart->isDigit();
 }
 
-void TodoExtractor::extractTodos()
+/**
+ * @return true when the double quote at @p it starts a raw string literal, as in R"(...)" or u8R"(...)"
+ */
+bool isRawStringLiteral(const QChar* begin, const QChar* it)
 {
-    using uintLimits = std::numeric_limits<uint>;
+    if (it == begin || *(it - 1) != QLatin1Char('R')) {
+        return false;
+    }
+    auto prefix = it - 1;
+    if (prefix - begin >= 2 && *(prefix - 1) == QLatin1Char('8') && *(prefix - 2) == QLatin1Char('u')) {
+        prefix -= 2;
+    } else if (prefix != begin && (*(prefix - 1) == QLatin1Char('u') || *(prefix - 1) == QLatin1Char('U')
+                                   || *(prefix - 1) == QLatin1Char('L'))) {
+        --prefix;
+    }
+    return prefix == begin || !isIdentifierCharacter(*(prefix - 1));
+}
 
-    auto start = clang_getLocation(m_unit, m_file, 1, 1);
-    auto end = clang_getLocation(m_unit, m_file, uintLimits::max(), uintLimits::max());
+/**
+ * @brief Finds the comments in the raw contents of a C/C++ file
+ *
+ * This only knows enough about the language to not mistake the contents of string and character
+ * literals for comments. Just like clang_tokenize, it doesn't evaluate preprocessor directives,
+ * i.e. comments in disabled code are found, too.
+ */
+class CommentScanner
+{
+public:
+    explicit CommentScanner(const QString& contents)
+        : m_begin(contents.constData())
+        , m_end(m_begin + contents.size())
+        , m_it(m_begin)
+        , m_lineStart(m_begin)
+    {
+    }
 
-    auto range = clang_getRange(start, end);
+    /**
+     * Calls @p visitor for every comment, with the text of the comment including its delimiters
+     * and the position of its first character
+     *
+     * NOTE: The text passed to @p visitor references the scanned contents and must not outlive them.
+     */
+    template<typename Visitor>
+    void visitComments(Visitor visitor)
+    {
+        while (m_it != m_end) {
+            const QChar c = *m_it;
+            if (c == QLatin1Char('/') && m_it + 1 != m_end
+                && (*(m_it + 1) == QLatin1Char('/') || *(m_it + 1) == QLatin1Char('*')))
+            {
+                const auto commentBegin = m_it;
+                const KTextEditor::Cursor commentStart(m_line, m_it - m_lineStart);
+                if (*(m_it + 1) == QLatin1Char('/')) {
+                    skipLineComment();
+                } else {
+                    skipBlockComment();
+                }
+                visitor(QString::fromRawData(commentBegin, m_it - commentBegin), commentStart);
+                continue;
+            } else if (c == QLatin1Char('"')) {
+                if (isRawStringLiteral(m_begin, m_it)) {
+                    skipRawStringLiteral();
+                } else {
+                    skipLiteral(c);
+                }
+                continue;
+            } else if (c == QLatin1Char('\'') && !isDigitSeparator(m_begin, m_it)) {
+                skipLiteral(c);
+                continue;
+            }
+            advance();
+        }
+    }
 
-    IndexedString path(QDir(ClangString(clang_getFileName(m_file)).toString()).canonicalPath());
+private:
+    inline void advance()
+    {
+        if (*m_it == QLatin1Char('\n')) {
+            ++m_line;
+            m_lineStart = m_it + 1;
+        }
+        ++m_it;
+    }
 
-    if(clang_Range_isNull(range)){
-        return;
+    void skipLineComment()
+    {
+        // a line comment continues on the next line when the newline is escaped
+        bool escaped = false;
+        while (m_it != m_end && (*m_it != QLatin1Char('\n') || escaped)) {
+            if (*m_it == QLatin1Char('\\')) {
+                escaped = true;
+            } else if (*m_it != QLatin1Char('\r')) {
+                escaped = false;
+            }
+            advance();
+        }
     }
 
-    const ClangTokens tokens(m_unit, range);
-    for (CXToken token : tokens) {
-        CXTokenKind tokenKind = clang_getTokenKind(token);
-        if (tokenKind != CXToken_Comment) {
-            continue;
+    void skipBlockComment()
+    {
+        // skip the opening delimiter, such that /*/ is not taken as a complete comment
+        advance();
+        advance();
+        while (m_it != m_end) {
+            if (*m_it == QLatin1Char('*') && m_it + 1 != m_end && *(m_it + 1) == QLatin1Char('/')) {
+                advance();
+                advance();
+                return;
+            }
+            advance();
         }
+    }
 
-        CXString tokenSpelling = clang_getTokenSpelling(m_unit, token);
-        auto tokenRange = ClangRange(clang_getTokenExtent(m_unit, token)).toRange();
-        const QString text = ClangString(tokenSpelling).toString();
-
-        CommentTodoParser parser(text, m_todoMarkerWords);
-        foreach (const CommentTodoParser::Result& result, parser.results()) {
-            ProblemPointer problem(new Problem);
-            problem->setDescription(result.description);
-            problem->setSeverity(IProblem::Hint);
-            problem->setSource(IProblem::ToDo);
-
-            // move the local range to the correct location
-            // note: localRange is the range *within* the comment only
-            auto localRange = result.localRange;
-            KTextEditor::Range todoRange{
-                tokenRange.start().line() + localRange.start().line(),
-                localRange.start().column(),
-                tokenRange.start().line() + localRange.end().line(),
-                localRange.end().column()};
-            problem->setFinalLocation({path, todoRange});
-            m_problems << problem;
+    /// skip a string or character literal, unterminated literals end at the end of the line
+    void skipLiteral(QChar quote)
+    {
+        advance();
+        while (m_it != m_end && *m_it != quote && *m_it != QLatin1Char('\n')) {
+            if (*m_it == QLatin1Char('\\') && m_it + 1 != m_end) {
+                advance();
+            }
+            advance();
+        }
+        if (m_it != m_end && *m_it == quote) {
+            advance();
         }
     }
+
+    void skipRawStringLiteral()
+    {
+        advance();
+        const auto delimiterBegin = m_it;
+        while (m_it != m_end && *m_it != QLatin1Char('(') && *m_it != QLatin1Char('\n')) {
+            advance();
+        }
+        if (m_it == m_end || *m_it == QLatin1Char('\n')) {
+            // invalid raw string literal
+            return;
+        }
+        const QString terminator = QLatin1Char(')') + QString(delimiterBegin, m_it - delimiterBegin) + QLatin1Char('"');
+        while (m_it != m_end) {
+            if (*m_it == QLatin1Char(')') && m_end - m_it >= terminator.size()
+                && QString::fromRawData(m_it, terminator.size()) == terminator)
+            {
+                for (int i = 0; i < terminator.size(); ++i) {
+                    advance();
+                }
+                return;
+            }
+            advance();
+        }
+    }
+
+    const QChar* const m_begin;
+    const QChar* const m_end;
+    const QChar* m_it;
+    const QChar* m_lineStart;
+    int m_line = 0;
+};
+
+}
+
+TodoExtractor::TodoExtractor(const QByteArray& contents, const IndexedString& path)
+    : m_path(path)
+    , m_todoMarkerWords(KDevelop::ICore::self()->languageController()->completionSettings()->todoMarkerWords())
+{
+    extractTodos(contents);
+}
+
+void TodoExtractor::extractTodos(const QByteArray& contents)
+{
+    // in most files there is no to-do item at all, make sure this case is sufficiently fast
+    // by searching the raw bytes before decoding them
+    const bool hasMarkerWord = std::any_of(m_todoMarkerWords.constBegin(), m_todoMarkerWords.constEnd(),
+                                           [&contents] (const QString& marker) {
+                                               return contents.contains(marker.toUtf8());
+                                           });
+    if (!hasMarkerWord) {
+        return;
+    }
+
+    const QString text = QString::fromUtf8(contents);
+    CommentScanner scanner(text);
+    scanner.visitComments([this] (const QString& comment, const KTextEditor::Cursor& commentStart) {
+        extractTodos(comment, commentStart);
+    });
+}
+
+void TodoExtractor::extractTodos(const QString& comment, const KTextEditor::Cursor& commentStart)
+{
+    CommentTodoParser parser(comment, m_todoMarkerWords);
+    foreach (const CommentTodoParser::Result& result, parser.results()) {
+        ProblemPointer problem(new Problem);
+        problem->setDescription(result.description);
+        problem->setSeverity(IProblem::Hint);
+        problem->setSource(IProblem::ToDo);
+
+        // move the local range to the correct location
+        // note: localRange is the range *within* the comment only
+        auto localRange = result.localRange;
+        const int columnOffset = localRange.start().line() == 0 ? commentStart.column() : 0;
+        KTextEditor::Range todoRange{
+            commentStart.line() + localRange.start().line(),
+            columnOffset + localRange.start().column(),
+            commentStart.line() + localRange.end().line(),
+            columnOffset + localRange.end().column()};
+        problem->setFinalLocation({m_path, todoRange});
+        m_problems << problem;
+    }
 }
 
 QList< ProblemPointer > TodoExtractor::problems() const
@@ -26,12 +26,23 @@
 
 #include <language/duchain/problem.h>
 
-#include <clang-c/Index.h>
+#include <serialization/indexedstring.h>
 
+/**
+ * Extracts to-do items from the comments of a file
+ *
+ * The comments are found by scanning the raw contents of the file, which is much cheaper
+ * than tokenizing it with clang. Files that don't contain any to-do marker word at all are
+ * skipped without decoding their contents.
+ */
 class KDEVCLANGPRIVATE_EXPORT TodoExtractor
 {
 public:
-    TodoExtractor(CXTranslationUnit unit, CXFile file);
+    /**
+     * @param contents the UTF-8 encoded contents of the file
+     * @param path the path of the file, used for the location of the problems
+     */
+    TodoExtractor(const QByteArray& contents, const KDevelop::IndexedString& path);
 
     /**
      * Retrieve the list of to-do problems this instance found
@@ -39,10 +50,10 @@ public:
     QList<KDevelop::ProblemPointer> problems() const;
 
 private:
-    void extractTodos();
+    void extractTodos(const QByteArray& contents);
+    void extractTodos(const QString& comment, const KTextEditor::Cursor& commentStart);
 
-    CXTranslationUnit m_unit;
-    CXFile m_file;
+    KDevelop::IndexedString m_path;
     QStringList m_todoMarkerWords;
 
     QList<KDevelop::ProblemPointer> m_problems;
@@ -0,0 +1,146 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "tokenhighlighting.h"
+
+#include "util/clangtypes.h"
+
+#include <limits>
+
+using namespace KDevelop;
+
+namespace {
+
+HighlightingEnumContainer::Types typeForVariable(CXCursor cursor)
+{
+    switch (clang_getCursorSemanticParent(cursor).kind) {
+    case CXCursor_TranslationUnit:
+        return HighlightingEnumContainer::GlobalVariableType;
+    case CXCursor_Namespace:
+        return HighlightingEnumContainer::NamespaceVariableType;
+    case CXCursor_StructDecl:
+    case CXCursor_UnionDecl:
+    case CXCursor_ClassDecl:
+    case CXCursor_ClassTemplate:
+    case CXCursor_ClassTemplatePartialSpecialization:
+        // static members
+        return HighlightingEnumContainer::MemberVariableType;
+    default:
+        return HighlightingEnumContainer::LocalVariableType;
+    }
+}
+
+/**
+ * @return the highlighting type for the declaration @p cursor, or UnknownType if it should not be highlighted
+ */
+HighlightingEnumContainer::Types typeForDeclaration(CXCursor cursor)
+{
+    switch (cursor.kind) {
+    case CXCursor_StructDecl:
+    case CXCursor_UnionDecl:
+    case CXCursor_ClassDecl:
+    case CXCursor_ClassTemplate:
+    case CXCursor_ClassTemplatePartialSpecialization:
+    case CXCursor_TemplateTypeParameter:
+    case CXCursor_TemplateTemplateParameter:
+        return HighlightingEnumContainer::ClassType;
+    case CXCursor_TypedefDecl:
+    case CXCursor_TypeAliasDecl:
+        return HighlightingEnumContainer::TypeAliasType;
+    case CXCursor_EnumDecl:
+        return HighlightingEnumContainer::EnumType;
+    case CXCursor_EnumConstantDecl:
+        return HighlightingEnumContainer::EnumeratorType;
+    case CXCursor_FunctionDecl:
+    case CXCursor_CXXMethod:
+    case CXCursor_Constructor:
+    case CXCursor_Destructor:
+    case CXCursor_ConversionFunction:
+    case CXCursor_FunctionTemplate:
+        return HighlightingEnumContainer::FunctionType;
+    case CXCursor_FieldDecl:
+        return HighlightingEnumContainer::MemberVariableType;
+    case CXCursor_ParmDecl:
+        return HighlightingEnumContainer::FunctionVariableType;
+    case CXCursor_VarDecl:
+        return typeForVariable(cursor);
+    case CXCursor_Namespace:
+    case CXCursor_NamespaceAlias:
+        return HighlightingEnumContainer::NamespaceType;
+    case CXCursor_MacroDefinition:
+        return HighlightingEnumContainer::MacroType;
+    default:
+        return HighlightingEnumContainer::UnknownType;
+    }
+}
+
+}
+
+QVector<HighlightedToken> TokenHighlighting::highlightedTokens(CXTranslationUnit unit, CXFile file,
+                                                               const KTextEditor::Range& range)
+{
+    const auto start = clang_getLocation(unit, file, range.start().line() + 1, 1);
+    auto end = clang_getLocation(unit, file, range.end().line() + 2, 1);
+    if (clang_equalLocations(end, clang_getNullLocation())) {
+        // the range reaches the end of the file
+        using uintLimits = std::numeric_limits<uint>;
+        end = clang_getLocation(unit, file, uintLimits::max(), uintLimits::max());
+    }
+    const auto sourceRange = clang_getRange(start, end);
+    if (clang_Range_isNull(sourceRange)) {
+        return {};
+    }
+
+    const ClangTokens tokens(unit, sourceRange);
+    QVector<CXCursor> cursors(tokens.size());
+    clang_annotateTokens(unit, tokens.begin(), tokens.size(), cursors.data());
+
+    QVector<HighlightedToken> highlightedTokens;
+    for (uint i = 0; i < tokens.size(); ++i) {
+        const auto token = tokens.at(i);
+        if (clang_getTokenKind(token) != CXToken_Identifier) {
+            continue;
+        }
+
+        const auto cursor = cursors[i];
+        const auto referenced = clang_getCursorReferenced(cursor);
+        if (clang_Cursor_isNull(referenced)) {
+            continue;
+        }
+
+        const auto type = typeForDeclaration(referenced);
+        if (type == HighlightingEnumContainer::UnknownType) {
+            continue;
+        }
+
+        auto context = HighlightingEnumContainer::ReferenceContext;
+        if (clang_equalCursors(cursor, referenced)) {
+            // tokens of a declaration are annotated with the declaration itself, only highlight its name
+            if (!clang_equalLocations(clang_getTokenLocation(unit, token), clang_getCursorLocation(cursor))) {
+                continue;
+            }
+            context = clang_isCursorDefinition(cursor) ? HighlightingEnumContainer::DefinitionContext
+                                                       : HighlightingEnumContainer::DeclarationContext;
+        }
+
+        highlightedTokens.append({ClangRange(clang_getTokenExtent(unit, token)).toRange(), type, context});
+    }
+    return highlightedTokens;
+}
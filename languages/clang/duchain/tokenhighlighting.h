@@ -0,0 +1,59 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef TOKENHIGHLIGHTING_H
+#define TOKENHIGHLIGHTING_H
+
+#include <QVector>
+
+#include <KTextEditor/Range>
+
+#include <language/highlighting/codehighlighting.h>
+
+#include <clang-c/Index.h>
+
+#include "clangprivateexport.h"
+
+/**
+ * An identifier token classified for highlighting, without the help of the DUChain
+ */
+struct KDEVCLANGPRIVATE_EXPORT HighlightedToken
+{
+    KTextEditor::Range range;
+    KDevelop::HighlightingEnumContainer::Types type;
+    KDevelop::HighlightingEnumContainer::Contexts context;
+};
+
+Q_DECLARE_TYPEINFO(HighlightedToken, Q_MOVABLE_TYPE);
+
+namespace TokenHighlighting
+{
+/**
+ * Classify the identifiers of @p file on the lines of @p range by annotating its tokens
+ *
+ * This only needs the translation unit, which makes it much faster than building the DUChain.
+ * The result is an approximation of the highlighting computed from the DUChain, e.g. there are
+ * no per-declaration colors for local variables.
+ */
+KDEVCLANGPRIVATE_EXPORT QVector<HighlightedToken> highlightedTokens(CXTranslationUnit unit, CXFile file,
+                                                                    const KTextEditor::Range& range);
+}
+
+#endif // TOKENHIGHLIGHTING_H
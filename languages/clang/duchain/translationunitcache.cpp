@@ -0,0 +1,287 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "translationunitcache.h"
+
+#include "astfiledependencies.h"
+#include "clanghelpers.h"
+#include "clangindex.h"
+#include "util/clangdebug.h"
+#include "util/clangtypes.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSet>
+
+#include <algorithm>
+
+using namespace KDevelop;
+
+namespace {
+
+quint64 budgetFromEnvironment()
+{
+    bool ok = false;
+    const auto megabytes = qgetenv("KDEV_CLANG_TU_CACHE_SIZE").toULongLong(&ok);
+    return (ok ? megabytes : 1024) * 1024 * 1024;
+}
+
+/**
+ * @return the main file and all files included by the translation unit of @p session
+ *
+ * NOTE: clang_getInclusions reports nothing after a reparse with a precompiled preamble, so don't use it here
+ */
+QVector<AstFileDependency> collectDependencies(const ParseSession& session)
+{
+    QSet<CXFile> files;
+    files.insert(session.mainFile());
+    const auto imports = ClangHelpers::tuImports(session.unit());
+    for (auto it = imports.constBegin(); it != imports.constEnd(); ++it) {
+        files.insert(it.key());
+        files.insert(it.value().file);
+    }
+
+    QVector<AstFileDependency> dependencies;
+    dependencies.reserve(files.size());
+    foreach (auto file, files) {
+        dependencies.append({ClangString(clang_getFileName(file)).toString(),
+                             static_cast<qint64>(clang_getFileTime(file))});
+    }
+    return dependencies;
+}
+
+/**
+ * @return true when the unsaved contents of @p file are the same as the file on disk, e.g. after it got saved
+ */
+bool matchesFileOnDisk(const UnsavedFile& file)
+{
+    QFile diskFile(file.fileName());
+    if (!diskFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const auto contents = file.contents();
+    const auto diskContents = diskFile.readAll();
+    // the unsaved contents are built from the lines of the document, each followed by a newline
+    return contents == diskContents || contents == diskContents + '\n';
+}
+
+class SaveJob : public QRunnable
+{
+public:
+    SaveJob(TranslationUnitCache* cache, const ParseSessionData::Ptr& data)
+        : m_cache(cache)
+        , m_data(data)
+    {
+    }
+
+    void run() override
+    {
+        m_cache->saveNow(m_data);
+    }
+
+private:
+    TranslationUnitCache* m_cache;
+    ParseSessionData::Ptr m_data;
+};
+
+}
+
+TranslationUnitCache::TranslationUnitCache(const QString& directory)
+    : m_directory(directory)
+    , m_budget(budgetFromEnvironment())
+    , m_enabled(qEnvironmentVariableIsSet("KDEV_CLANG_TU_CACHE"))
+{
+    // saving is I/O bound, don't compete with the parse jobs
+    m_savePool.setMaxThreadCount(1);
+}
+
+TranslationUnitCache::~TranslationUnitCache()
+{
+    waitForSaved();
+}
+
+bool TranslationUnitCache::isEnabled() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_enabled;
+}
+
+void TranslationUnitCache::setEnabled(bool enabled)
+{
+    QMutexLocker lock(&m_mutex);
+    m_enabled = enabled;
+}
+
+void TranslationUnitCache::setBudget(quint64 bytes)
+{
+    QMutexLocker lock(&m_mutex);
+    m_budget = bytes;
+    evict();
+}
+
+void TranslationUnitCache::save(const ParseSessionData::Ptr& data)
+{
+    if (!data || !isEnabled()) {
+        return;
+    }
+    m_savePool.start(new SaveJob(this, data));
+}
+
+bool TranslationUnitCache::saveNow(const ParseSessionData::Ptr& data)
+{
+    if (!data || !isEnabled()) {
+        return false;
+    }
+
+    ParseSession session(data);
+    if (!session.unit()) {
+        return false;
+    }
+
+    const auto environment = session.environment();
+    auto dependencies = collectDependencies(session);
+    foreach (const auto& unsavedFile, session.unsavedFiles()) {
+        const auto fileName = unsavedFile.fileName();
+        auto it = std::find_if(dependencies.begin(), dependencies.end(), [&fileName] (const AstFileDependency& dependency) {
+            return dependency.path == fileName;
+        });
+        if (it == dependencies.end()) {
+            continue;
+        }
+        if (!matchesFileOnDisk(unsavedFile)) {
+            // the unit does not match the contents on disk
+            return false;
+        }
+        // the document got saved since, depend on the file as it is now
+        *it = AstFileDependencies::dependencyOnFile(fileName);
+    }
+
+    const auto pchFile = session.pchFile();
+    if (!pchFile.isEmpty()) {
+        // the saved unit references the precompiled header, so it is only valid as long as that is
+        const auto pchDependencies = AstFileDependencies::read(pchFile, environment.hash());
+        if (pchDependencies.isEmpty()) {
+            return false;
+        }
+        dependencies.append(AstFileDependencies::dependencyOnFile(pchFile));
+        dependencies += pchDependencies;
+    } else if (environment.pchInclude().isValid()) {
+        // the pch include got included directly, it is not reported as an import
+        dependencies.append(AstFileDependencies::dependencyOnFile(environment.pchInclude().toLocalFile()));
+    }
+
+    const auto file = astFile(environment);
+    if (file.isEmpty()) {
+        return false;
+    }
+
+    // invalidate the previous unit first, such that a partially written one is never loaded
+    AstFileDependencies::remove(file);
+    const auto code = clang_saveTranslationUnit(session.unit(), QFile::encodeName(file).constData(),
+                                                CXSaveTranslationUnit_None);
+    if (code != CXSaveError_None || !AstFileDependencies::write(file, environment.hash(), dependencies)) {
+        qCWarning(KDEV_CLANG) << "Failed to save translation unit" << environment.translationUnitUrl() << "to" << file;
+        QFile::remove(file);
+        return false;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    evict();
+    return true;
+}
+
+void TranslationUnitCache::waitForSaved()
+{
+    m_savePool.waitForDone();
+}
+
+ParseSessionData::Ptr TranslationUnitCache::load(const ClangParsingEnvironment& environment, ClangIndex* index)
+{
+    if (!isEnabled()) {
+        return {};
+    }
+
+    const auto file = astFile(environment);
+    if (file.isEmpty()) {
+        return {};
+    }
+    const auto dependencies = AstFileDependencies::read(file, environment.hash());
+
+    // keep the precompiled header the unit references from being evicted, before checking that it is up to date
+    QSharedPointer<const QString> pchFile;
+    if (environment.pchInclude().isValid()) {
+        const auto path = index->pchCacheFile(environment);
+        if (!path.isEmpty() && std::any_of(dependencies.begin(), dependencies.end(), [&path] (const AstFileDependency& dependency) {
+            return dependency.path == path;
+        })) {
+            pchFile = index->referencePchFile(path);
+        }
+    }
+
+    if (!AstFileDependencies::isUpToDate(dependencies)) {
+        return {};
+    }
+
+    auto data = ParseSessionData::loadFromAstFile(file, index, environment, pchFile);
+    if (data) {
+        clangDebug() << "Loaded translation unit" << environment.translationUnitUrl() << "from" << file;
+    }
+    return data;
+}
+
+QString TranslationUnitCache::astFile(const ClangParsingEnvironment& environment) const
+{
+    if (m_directory.isEmpty() || !QDir().mkpath(m_directory)) {
+        return {};
+    }
+
+    // changes to the contents of the parsed files are detected by their dependencies
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(environment.translationUnitUrl().byteArray());
+    hash.addData(QByteArray::number(environment.hash()));
+    hash.addData(ClangString(clang_getClangVersion()).toByteArray());
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".ast");
+}
+
+void TranslationUnitCache::evict()
+{
+    auto files = QDir(m_directory).entryInfoList({QStringLiteral("*.ast")}, QDir::Files);
+    quint64 size = 0;
+    foreach (const auto& file, files) {
+        size += file.size();
+    }
+    if (size <= m_budget) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [] (const QFileInfo& lhs, const QFileInfo& rhs) {
+        return lhs.lastModified() < rhs.lastModified();
+    });
+    // always keep the most recently saved unit
+    for (int i = 0; i < files.size() - 1 && size > m_budget; ++i) {
+        const auto path = files[i].absoluteFilePath();
+        AstFileDependencies::remove(path);
+        QFile::remove(path);
+        size -= files[i].size();
+    }
+}
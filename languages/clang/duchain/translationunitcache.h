@@ -0,0 +1,105 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef TRANSLATIONUNITCACHE_H
+#define TRANSLATIONUNITCACHE_H
+
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+
+#include "clangprivateexport.h"
+#include "parsesession.h"
+
+class ClangIndex;
+
+/**
+ * Opt-in cache of parsed translation units on disk
+ *
+ * The translation units of closed documents are saved, such that their AST can be attached
+ * quickly when the documents get opened again, instead of parsing them from scratch.
+ * A saved translation unit is only loaded for the environment it was parsed in, and when
+ * none of the files that went into it changed since.
+ *
+ * NOTE: libclang can neither reparse nor code-complete a translation unit loaded from disk,
+ *       so it should be replaced by a fresh parse in the background.
+ *
+ * This class is thread safe.
+ */
+class KDEVCLANGPRIVATE_EXPORT TranslationUnitCache
+{
+public:
+    /**
+     * The cache is disabled unless the KDEV_CLANG_TU_CACHE environment variable is set
+     *
+     * Its size defaults to 1 GiB, which can be overridden in MiB via the KDEV_CLANG_TU_CACHE_SIZE environment variable.
+     */
+    explicit TranslationUnitCache(const QString& directory);
+    ~TranslationUnitCache();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Set the maximum size in bytes of the saved translation units, the oldest ones are removed beyond that
+     */
+    void setBudget(quint64 bytes);
+
+    /**
+     * Save the translation unit of @p data in the background
+     */
+    void save(const ParseSessionData::Ptr& data);
+
+    /**
+     * Save the translation unit of @p data and wait until it is written
+     *
+     * Translation units parsed with unsaved editor contents are only saved when those got saved to disk meanwhile,
+     * as they could not be validated when loading them otherwise. Translation units parsed with a precompiled
+     * header depend on its file and the files that went into it.
+     *
+     * @return true when the translation unit got saved
+     */
+    bool saveNow(const ParseSessionData::Ptr& data);
+
+    /**
+     * Wait until all translation units queued by @ref save are written
+     */
+    void waitForSaved();
+
+    /**
+     * @return the translation unit saved for @p environment if it is up to date, or a null pointer
+     */
+    ParseSessionData::Ptr load(const ClangParsingEnvironment& environment, ClangIndex* index);
+
+private:
+    Q_DISABLE_COPY(TranslationUnitCache)
+
+    QString astFile(const ClangParsingEnvironment& environment) const;
+    /// Remove the oldest translation units until the cache fits into the budget
+    void evict();
+
+    mutable QMutex m_mutex;
+    const QString m_directory;
+    quint64 m_budget;
+    bool m_enabled;
+    QThreadPool m_savePool;
+};
+
+#endif // TRANSLATIONUNITCACHE_H
@@ -0,0 +1,204 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "translationunittrimmer.h"
+
+#include "parsesession.h"
+#include "util/clangdebug.h"
+
+#include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/duchainutils.h>
+#include <language/duchain/topducontext.h>
+
+#include <algorithm>
+
+using namespace KDevelop;
+
+namespace {
+
+const qint64 minute = 60 * 1000;
+
+quint64 memoryBudgetFromEnvironment()
+{
+    bool ok = false;
+    const auto megabytes = qgetenv("KDEV_CLANG_TU_MEMORY_BUDGET").toULongLong(&ok);
+    return (ok ? megabytes : 2048) * 1024 * 1024;
+}
+
+int idleMinutesFromEnvironment()
+{
+    bool ok = false;
+    const auto minutes = qgetenv("KDEV_CLANG_TU_IDLE_MINUTES").toInt(&ok);
+    return ok ? minutes : 30;
+}
+
+quint64 toMiB(quint64 bytes)
+{
+    return bytes / (1024 * 1024);
+}
+
+/// A translation unit and the contexts of the open documents it is attached to
+struct AttachedUnit
+{
+    ParseSessionData::Ptr data;
+    QVector<ReferencedTopDUContext> contexts;
+    qint64 lastUsed;
+    bool active;
+};
+
+/**
+ * @return the translation units attached to the contexts of open documents
+ */
+QVector<AttachedUnit> attachedUnits(const QHash<IndexedString, qint64>& lastUsed)
+{
+    auto documentController = ICore::self()->documentController();
+    const auto activeDocument = documentController->activeDocument();
+
+    QVector<AttachedUnit> units;
+    DUChainReadLocker lock;
+    foreach (auto document, documentController->openDocuments()) {
+        auto context = DUChainUtils::standardContextForUrl(document->url());
+        if (!context) {
+            continue;
+        }
+        const ParseSessionData::Ptr data(dynamic_cast<ParseSessionData*>(context->ast().data()));
+        if (!data) {
+            continue;
+        }
+
+        // headers pinned to an open translation unit share its data
+        auto it = std::find_if(units.begin(), units.end(), [&data] (const AttachedUnit& unit) {
+            return unit.data == data;
+        });
+        if (it == units.end()) {
+            units.append({data, {}, 0, false});
+            it = units.end() - 1;
+        }
+        it->contexts.append(ReferencedTopDUContext(context));
+        it->lastUsed = qMax(it->lastUsed, lastUsed.value(IndexedString(document->url())));
+        it->active = it->active || document == activeDocument;
+    }
+    return units;
+}
+
+}
+
+TranslationUnitTrimmer::TranslationUnitTrimmer(QObject* parent)
+    : QObject(parent)
+    , m_memoryBudget(memoryBudgetFromEnvironment())
+    , m_idleTimeout(idleMinutesFromEnvironment() * minute)
+{
+    m_clock.start();
+
+    auto documentController = ICore::self()->documentController();
+    foreach (auto document, documentController->openDocuments()) {
+        documentUsed(document);
+    }
+    connect(documentController, &IDocumentController::documentOpened,
+            this, &TranslationUnitTrimmer::documentUsed);
+    connect(documentController, &IDocumentController::documentActivated,
+            this, &TranslationUnitTrimmer::documentUsed);
+    connect(documentController, &IDocumentController::documentContentChanged,
+            this, &TranslationUnitTrimmer::documentUsed);
+    connect(documentController, &IDocumentController::documentClosed,
+            this, &TranslationUnitTrimmer::documentClosed);
+
+    m_timer.setInterval(minute);
+    connect(&m_timer, &QTimer::timeout, this, &TranslationUnitTrimmer::trim);
+    m_timer.start();
+}
+
+TranslationUnitTrimmer::~TranslationUnitTrimmer() = default;
+
+void TranslationUnitTrimmer::setMemoryBudget(quint64 bytes)
+{
+    m_memoryBudget = bytes;
+}
+
+void TranslationUnitTrimmer::setIdleTimeout(int minutes)
+{
+    m_idleTimeout = minutes * minute;
+}
+
+TranslationUnitTrimmer::Usage TranslationUnitTrimmer::usage() const
+{
+    Usage usage;
+    foreach (const auto& unit, attachedUnits(m_lastUsed)) {
+        ++usage.translationUnits;
+        usage.bytes += unit.data->memoryUsage();
+    }
+    return usage;
+}
+
+void TranslationUnitTrimmer::trim()
+{
+    auto units = attachedUnits(m_lastUsed);
+    std::sort(units.begin(), units.end(), [] (const AttachedUnit& lhs, const AttachedUnit& rhs) {
+        return lhs.lastUsed < rhs.lastUsed;
+    });
+
+    quint64 usage = 0;
+    foreach (const auto& unit, units) {
+        usage += unit.data->memoryUsage();
+    }
+    clangDebug() << "translation units of open documents:" << units.size() << "using" << toMiB(usage)
+                 << "MiB of" << toMiB(m_memoryBudget) << "MiB";
+
+    const auto now = m_clock.elapsed();
+    int disposed = 0;
+    foreach (const auto& unit, units) {
+        // least recently used first, so the idle ones come before all others
+        const bool idle = m_idleTimeout && now - unit.lastUsed > m_idleTimeout;
+        if (!idle && usage <= m_memoryBudget) {
+            break;
+        }
+        if (unit.active) {
+            // in use right now
+            continue;
+        }
+
+        {
+            // the unit is disposed once running jobs are done with it, too
+            DUChainWriteLocker lock;
+            foreach (const auto& context, unit.contexts) {
+                context->setAst({});
+            }
+        }
+        usage -= unit.data->memoryUsage();
+        ++disposed;
+    }
+
+    if (disposed) {
+        clangDebug() << "disposed" << disposed << "translation units, now using" << toMiB(usage) << "MiB";
+    }
+}
+
+void TranslationUnitTrimmer::documentUsed(IDocument* document)
+{
+    m_lastUsed[IndexedString(document->url())] = m_clock.elapsed();
+}
+
+void TranslationUnitTrimmer::documentClosed(IDocument* document)
+{
+    m_lastUsed.remove(IndexedString(document->url()));
+}
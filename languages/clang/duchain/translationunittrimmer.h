@@ -0,0 +1,101 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef TRANSLATIONUNITTRIMMER_H
+#define TRANSLATIONUNITTRIMMER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+#include <serialization/indexedstring.h>
+
+#include "clangprivateexport.h"
+
+namespace KDevelop {
+class IDocument;
+}
+
+/**
+ * Keeps the memory used by the translation units of open documents in check
+ *
+ * The contexts of open documents keep their parsed translation unit attached, including
+ * its precompiled preamble, to quickly reparse them and for code completion. This disposes
+ * the translation units of documents that were not used for a while, and of the least
+ * recently used documents while all of them together exceed the memory budget.
+ *
+ * A disposed translation unit gets recreated once its document is activated again.
+ */
+class KDEVCLANGPRIVATE_EXPORT TranslationUnitTrimmer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TranslationUnitTrimmer(QObject* parent = nullptr);
+    ~TranslationUnitTrimmer() override;
+
+    /**
+     * Set the budget in bytes for the translation units of all open documents
+     *
+     * Defaults to 2 GiB, which can be overridden in MiB via the KDEV_CLANG_TU_MEMORY_BUDGET environment variable.
+     */
+    void setMemoryBudget(quint64 bytes);
+
+    /**
+     * Set the number of minutes after which the translation unit of an unused document is disposed
+     *
+     * Defaults to 30 minutes, which can be overridden via the KDEV_CLANG_TU_IDLE_MINUTES environment variable.
+     * Zero keeps the translation units of idle documents.
+     */
+    void setIdleTimeout(int minutes);
+
+    struct Usage
+    {
+        /// the number of translation units attached to open documents
+        int translationUnits = 0;
+        /// the memory used by these translation units in bytes
+        quint64 bytes = 0;
+    };
+    /**
+     * @return the memory currently used by the translation units of open documents
+     */
+    Usage usage() const;
+
+public slots:
+    /**
+     * Dispose the translation units of idle documents, and those of the least
+     * recently used documents while the memory budget is exceeded
+     */
+    void trim();
+
+private slots:
+    void documentUsed(KDevelop::IDocument* document);
+    void documentClosed(KDevelop::IDocument* document);
+
+private:
+    quint64 m_memoryBudget;
+    qint64 m_idleTimeout;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    /// the time of the last use of open documents, as elapsed on m_clock
+    QHash<KDevelop::IndexedString, qint64> m_lastUsed;
+};
+
+#endif // TRANSLATIONUNITTRIMMER_H
@@ -22,7 +22,7 @@
 
 #include "unknowndeclarationproblem.h"
 
-#include "clanghelpers.h"
+#include "headernameindex.h"
 #include "parsesession.h"
 #include "../util/clangdebug.h"
 #include "../util/clangutils.h"
@@ -61,67 +61,6 @@ namespace {
  */
 const int maxSuggestions = 5;
 
-/**
- * We don't want anything from the bits directory -
- * we'd rather prefer forwarding includes, such as <vector>
- */
-bool isBlacklisted(const QString& path)
-{
-    if (ClangHelpers::isSource(path))
-        return true;
-
-    // Do not allow including directly from the bits directory.
-    // Instead use one of the forwarding headers in other directories, when possible.
-    if (path.contains( QLatin1String("bits") ) && path.contains(QLatin1String("/include/c++/")))
-        return true;
-
-    return false;
-}
-
-QStringList scanIncludePaths( const QString& identifier, const QDir& dir, int maxDepth = 3 )
-{
-    if (!maxDepth) {
-        return {};
-    }
-
-    QStringList candidates;
-    const auto path = dir.absolutePath();
-
-    if( isBlacklisted( path ) ) {
-        return {};
-    }
-
-    for (const auto& file : dir.entryList({identifier + QLatin1Char('*')}, QDir::Files)) {
-        if (identifier.compare(file, Qt::CaseInsensitive) == 0 || ClangHelpers::isHeader(file)) {
-            const QString filePath = path + QLatin1Char('/') + file;
-            clangDebug() << "Found candidate file" << filePath;
-            candidates.append( filePath );
-        }
-    }
-
-    maxDepth--;
-    for( const auto& subdir : dir.entryList( QDir::Dirs | QDir::NoDotAndDotDot ) )
-        candidates += scanIncludePaths( identifier, QDir{ path + QLatin1Char('/') + subdir }, maxDepth );
-
-    return candidates;
-}
-
-/*
- * Find files in dir that match the given identifier. Matches common C++ header file extensions only.
- */
-QStringList scanIncludePaths( const QualifiedIdentifier& identifier, const KDevelop::Path::List& includes )
-{
-    const auto stripped_identifier = identifier.last().toString();
-    QStringList candidates;
-    for( const auto& include : includes ) {
-        candidates += scanIncludePaths( stripped_identifier, QDir{ include.toLocalFile() } );
-    }
-
-    std::sort( candidates.begin(), candidates.end() );
-    candidates.erase( std::unique( candidates.begin(), candidates.end() ), candidates.end() );
-    return candidates;
-}
-
 /*
  * Determine how much path is shared between two includes.
  *  boost/tr1/unordered_map
@@ -300,13 +239,13 @@ QStringList duchainCandidates( const QualifiedIdentifier& identifier, const KDev
 
             const auto filepath = decl->url().toUrl().toLocalFile();
 
-            if( !isBlacklisted( filepath ) ) {
+            if( !HeaderNameIndex::isBlacklisted( filepath ) ) {
                 candidates << filepath;
                 clangDebug() << "Adding" << filepath << "determined from candidate" << declaration;
             }
 
             for( const auto importer : file->importers() ) {
-                if( importer->imports().count() != 1 && !isBlacklisted( filepath ) ) {
+                if( importer->imports().count() != 1 && !HeaderNameIndex::isBlacklisted( filepath ) ) {
                     continue;
                 }
                 if( importer->topContext()->localDeclarations().count() ) {
@@ -314,7 +253,7 @@ QStringList duchainCandidates( const QualifiedIdentifier& identifier, const KDev
                 }
 
                 const auto filePath = importer->url().toUrl().toLocalFile();
-                if( isBlacklisted( filePath ) ) {
+                if( HeaderNameIndex::isBlacklisted( filePath ) ) {
                     continue;
                 }
 
@@ -413,7 +352,7 @@ QStringList includeFiles( const QualifiedIdentifier& identifier, const KDevelop:
         return candidates;
     }
 
-    return scanIncludePaths( identifier, includes );
+    return HeaderNameIndex::self()->headersForIdentifier( identifier.last().toString(), includes );
 }
 
 /*
@@ -500,6 +439,11 @@ void UnknownDeclarationProblem::setSymbol(const QualifiedIdentifier& identifier)
     m_identifier = identifier;
 }
 
+ClangProblem::Ptr UnknownDeclarationProblem::clone() const
+{
+    return ClangProblem::Ptr(new UnknownDeclarationProblem(*this));
+}
+
 IAssistant::Ptr UnknownDeclarationProblem::solutionAssistant() const
 {
     const Path path(finalLocation().document.str());
@@ -39,6 +39,8 @@ public:
 
     void setSymbol(const KDevelop::QualifiedIdentifier& identifier);
 
+    ClangProblem::Ptr clone() const override;
+
     virtual KDevelop::IAssistant::Ptr solutionAssistant() const override;
 
 private:
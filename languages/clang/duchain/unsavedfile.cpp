@@ -29,30 +29,30 @@
 
 UnsavedFile::UnsavedFile(const QString& fileName, const QStringList& contents)
     : m_fileName(fileName)
-    , m_contents(contents)
+    , m_fileNameUtf8(fileName.toUtf8())
 {
+    foreach(const QString& line, contents) {
+        m_contentsUtf8 += line.toUtf8();
+        m_contentsUtf8 += '\n';
+    }
 }
 
 CXUnsavedFile UnsavedFile::toClangApi() const
 {
-    if (m_fileNameUtf8.isEmpty()) {
-        const_cast<UnsavedFile*>(this)->convertToUtf8();
-    }
-
     CXUnsavedFile file;
-    file.Contents = m_contentsUtf8.data();
+    file.Contents = m_contentsUtf8.constData();
     file.Length = m_contentsUtf8.size();
-    file.Filename = m_fileNameUtf8.data();
+    file.Filename = m_fileNameUtf8.constData();
 
     return file;
 }
 
-void UnsavedFile::convertToUtf8()
+QString UnsavedFile::fileName() const
 {
-    m_fileNameUtf8 = m_fileName.toUtf8();
-    m_contentsUtf8.clear();
-    foreach(const QString& line, m_contents) {
-        m_contentsUtf8 += line.toUtf8();
-        m_contentsUtf8 += '\n';
-    }
+    return m_fileName;
+}
+
+QByteArray UnsavedFile::contents() const
+{
+    return m_contentsUtf8;
 }
@@ -38,11 +38,16 @@ public:
 
     CXUnsavedFile toClangApi() const;
 
+    QString fileName() const;
+
+    /**
+     * @return the UTF-8 encoded contents of this file
+     */
+    QByteArray contents() const;
+
 private:
     QString m_fileName;
-    QStringList m_contents;
-    // lazy-loaded byte arrays for usage in clang API
-    void convertToUtf8();
+    // the UTF-8 encoded data for usage in clang API, implicitly shared between copies
     QByteArray m_fileNameUtf8;
     QByteArray m_contentsUtf8;
 };
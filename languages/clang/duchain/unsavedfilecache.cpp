@@ -0,0 +1,90 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "unsavedfilecache.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <KTextEditor/Document>
+#include <KTextEditor/MovingInterface>
+
+UnsavedFileCache::UnsavedFileCache()
+{
+    // documents are only accessed from the main thread, make sure the connections are handled there as well
+    moveToThread(QCoreApplication::instance()->thread());
+}
+
+UnsavedFileCache::~UnsavedFileCache() = default;
+
+UnsavedFile UnsavedFileCache::unsavedFile(KTextEditor::Document* document)
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    auto movingInterface = qobject_cast<KTextEditor::MovingInterface*>(document);
+    const qint64 revision = movingInterface ? movingInterface->revision() : -1;
+    const QString fileName = document->url().toLocalFile();
+
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_snapshots.constFind(document);
+        if (it != m_snapshots.constEnd()) {
+            if (revision != -1 && it->revision == revision && it->file.fileName() == fileName) {
+                return it->file;
+            }
+        } else {
+            connect(document, &KTextEditor::Document::modifiedChanged,
+                    this, [this] (KTextEditor::Document* document) {
+                        if (!document->isModified()) {
+                            removeDocument(document);
+                        }
+                    });
+            connect(document, &KTextEditor::Document::aboutToClose,
+                    this, &UnsavedFileCache::removeDocument);
+        }
+    }
+
+    // encode outside the lock, no other thread modifies the snapshot of this document
+    const UnsavedFile file(fileName, {document->text()});
+
+    QMutexLocker lock(&m_mutex);
+    m_snapshots.insert(document, {revision, file});
+    return file;
+}
+
+QVector<UnsavedFile> UnsavedFileCache::unsavedFiles() const
+{
+    QVector<UnsavedFile> files;
+    QMutexLocker lock(&m_mutex);
+    files.reserve(m_snapshots.size());
+    foreach (const auto& snapshot, m_snapshots) {
+        files.append(snapshot.file);
+    }
+    return files;
+}
+
+void UnsavedFileCache::removeDocument(KTextEditor::Document* document)
+{
+    disconnect(document, nullptr, this, nullptr);
+
+    QMutexLocker lock(&m_mutex);
+    m_snapshots.remove(document);
+}
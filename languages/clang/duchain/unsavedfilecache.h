@@ -0,0 +1,78 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef UNSAVEDFILECACHE_H
+#define UNSAVEDFILECACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include "unsavedfile.h"
+#include "clangprivateexport.h"
+
+namespace KTextEditor {
+class Document;
+}
+
+/**
+ * Shared cache of the UTF-8 encoded contents of modified documents.
+ *
+ * A document is only encoded again once its revision changed, all users share
+ * the encoded contents of the same revision.
+ *
+ * The cache of the clang plugin is owned by its ClangIndex, see ClangIndex::unsavedFileCache.
+ */
+class KDEVCLANGPRIVATE_EXPORT UnsavedFileCache : public QObject
+{
+    Q_OBJECT
+public:
+    UnsavedFileCache();
+    ~UnsavedFileCache() override;
+
+    /**
+     * @return the current contents of the modified @p document
+     *
+     * NOTE: This accesses the document and must thus be called from the main thread.
+     */
+    UnsavedFile unsavedFile(KTextEditor::Document* document);
+
+    /**
+     * @return the last known contents of all modified documents
+     *
+     * This is thread safe, but may lag behind the latest edits.
+     */
+    QVector<UnsavedFile> unsavedFiles() const;
+
+private:
+    void removeDocument(KTextEditor::Document* document);
+
+    struct Snapshot
+    {
+        qint64 revision;
+        UnsavedFile file;
+    };
+
+    mutable QMutex m_mutex;
+    QHash<KTextEditor::Document*, Snapshot> m_snapshots;
+};
+
+#endif // UNSAVEDFILECACHE_H
@@ -22,8 +22,14 @@
 
 #include <QTest>
 #include <QSignalSpy>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
 
 #include <KTextEditor/Cursor>
+#include <KTextEditor/Document>
+#include <KTextEditor/View>
 
 #include <tests/testfile.h>
 
@@ -33,11 +39,76 @@
 #include "duchain/clangindex.h"
 
 #include "codecompletion/model.h"
+#include "codecompletion/includedirectoryindex.h"
+
+#include <algorithm>
 
 QTEST_MAIN(BenchCodeCompletion);
 
 using namespace KDevelop;
 
+namespace {
+
+const int includeTreeDirectories = 100;
+const int includeTreeHeadersPerDirectory = 1000;
+
+/**
+ * @return a directory with a synthetic tree of 100k headers, created on first use
+ */
+QString includeTree()
+{
+    static QTemporaryDir dir;
+    static bool created = false;
+    if (!created) {
+        for (int i = 0; i < includeTreeDirectories; ++i) {
+            const QString subDir = QStringLiteral("dir%1").arg(i);
+            QDir(dir.path()).mkdir(subDir);
+            for (int j = 0; j < includeTreeHeadersPerDirectory; ++j) {
+                QFile header(QStringLiteral("%1/%2/header%3.h").arg(dir.path(), subDir).arg(j));
+                header.open(QIODevice::WriteOnly);
+            }
+        }
+        created = true;
+    }
+    return dir.path();
+}
+
+/**
+ * Print a histogram of the completion @p latencies in milliseconds and report their median as benchmark result
+ */
+void reportLatencies(QVector<double> latencies)
+{
+    if (latencies.isEmpty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const double bucketLimits[] = {5, 10, 20, 50, 100, 200, 500, 1000};
+    const int numBuckets = sizeof(bucketLimits) / sizeof(bucketLimits[0]);
+    QVector<int> counts(numBuckets + 1, 0);
+    foreach (double latency, latencies) {
+        const auto bucket = std::upper_bound(bucketLimits, bucketLimits + numBuckets, latency) - bucketLimits;
+        ++counts[bucket];
+    }
+
+    auto percentile = [&latencies] (int percent) {
+        return latencies[qMin(latencies.size() - 1, latencies.size() * percent / 100)];
+    };
+
+    qDebug() << "completion latencies of" << latencies.size() << "requests:";
+    for (int i = 0; i <= numBuckets; ++i) {
+        const QString label = i < numBuckets ? QStringLiteral("< %1 ms").arg(bucketLimits[i])
+                                             : QStringLiteral(">= %1 ms").arg(bucketLimits[numBuckets - 1]);
+        qDebug().noquote() << label.rightJustified(11) << QString(counts[i], QLatin1Char('#')) << counts[i];
+    }
+    qDebug() << "p50:" << percentile(50) << "ms, p90:" << percentile(90) << "ms, p99:" << percentile(99)
+             << "ms, max:" << latencies.last() << "ms";
+
+    QTest::setBenchmarkResult(percentile(50), QTest::WalltimeMilliseconds);
+}
+
+}
+
 BenchCodeCompletion::BenchCodeCompletion()
     : m_index(new ClangIndex)
     , m_model(new ClangCodeCompletionModel(m_index.data(), this))
@@ -95,3 +166,83 @@ void BenchCodeCompletion::benchCodeCompletion()
         } while (!m_model->rowCount());
     }
 }
+
+void BenchCodeCompletion::benchCodeCompletionLatency_data()
+{
+    QTest::addColumn<int>("burstSize");
+
+    QTest::newRow("keystrokes") << 1;
+    QTest::newRow("bursts") << 4;
+}
+
+void BenchCodeCompletion::benchCodeCompletionLatency()
+{
+    // completion is requested for every typed letter, but only every burstSize-th request waits for the result,
+    // i.e. the other requests get superseded before they are done, as when typing fast
+    QFETCH(int, burstSize);
+
+    const QString code = QStringLiteral("#include <vector>\n#include <string>\n\nint main()\n{\n    \n}\n");
+    TestFile file(code, "cpp");
+    QVERIFY(file.parseAndWait(TopDUContext::AllDeclarationsContextsUsesAndAST, 1, 5000));
+
+    auto view = createView(file.url().toUrl(), this);
+    auto document = view->document();
+
+    // each keystroke changes the text before the cursor, so the completion items are never reused
+    const QString typed = QStringLiteral("std::vector<int>().size(); std::string().append(std::to_string(sizeof(int))).size();");
+    KTextEditor::Cursor position(5, 4);
+
+    QSignalSpy spy(m_model, &QAbstractItemModel::modelReset);
+    QVector<double> latencies;
+    int requests = 0;
+    foreach (const QChar c, typed) {
+        document->insertText(position, c);
+        position.setColumn(position.column() + 1);
+        if (!c.isLetter()) {
+            // like automatic invocation, only request completion while typing identifiers
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        m_model->completionInvoked(view.get(), {position, position}, KTextEditor::CodeCompletionModel::AutomaticInvocation);
+        if (++requests % burstSize) {
+            continue;
+        }
+
+        while (!m_model->rowCount() && spy.wait(5000)) {
+        }
+        QVERIFY(m_model->rowCount());
+        latencies << timer.nsecsElapsed() / 1e6;
+    }
+
+    reportLatencies(latencies);
+}
+
+void BenchCodeCompletion::benchIncludeDirectoryIndex_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("uncached") << false;
+    QTest::newRow("cached") << true;
+}
+
+void BenchCodeCompletion::benchIncludeDirectoryIndex()
+{
+    QFETCH(bool, cached);
+
+    const auto root = includeTree();
+    IncludeDirectoryIndex index;
+    QCOMPARE(index.entries(root).size(), includeTreeDirectories);
+
+    QBENCHMARK {
+        if (!cached) {
+            index.clear();
+        }
+        int headers = 0;
+        for (int i = 0; i < includeTreeDirectories; ++i) {
+            headers += index.entries(root + QStringLiteral("/dir%1").arg(i)).size();
+        }
+        QCOMPARE(headers, includeTreeDirectories * includeTreeHeadersPerDirectory);
+    }
+}
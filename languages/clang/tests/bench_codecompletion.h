@@ -37,6 +37,10 @@ public:
 private slots:
     void benchCodeCompletion_data();
     void benchCodeCompletion();
+    void benchCodeCompletionLatency_data();
+    void benchCodeCompletionLatency();
+    void benchIncludeDirectoryIndex_data();
+    void benchIncludeDirectoryIndex();
 
 private:
     QScopedPointer<ClangIndex> m_index;
@@ -20,14 +20,38 @@
 */
 
 #include <KAboutData>
+#include <KShell>
 
+#include <interfaces/icore.h>
+#include <interfaces/ilanguagecontroller.h>
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/backgroundparser/parsejob.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/duchainlock.h>
 #include <language/util/debuglanguageparserhelper.h>
+#include <languages/plugins/custom-definesandincludes/idefinesandincludesmanager.h>
+#include <tests/autotestshell.h>
+#include <tests/testcore.h>
 
 #include "../duchain/parsesession.h"
 #include "../duchain/debugvisitor.h"
+#include "../duchain/clanghelpers.h"
 #include "../duchain/clangindex.h"
+#include "../util/clangtrace.h"
 #include "../util/clangtypes.h"
 
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+
 using namespace KDevelop;
 using namespace KDevelopUtils;
 
@@ -64,7 +88,339 @@ public:
     {
         m_includePaths = paths;
     }
+
+    /**
+     * Benchmark what happens when @p header changes: parse all @p files, then reparse
+     * only the translation units that include @p header, as found in the index
+     *
+     * @return the exit code
+     */
+    int benchTouchHeader(const QString& header, const QStringList& files)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        int parsed = 0;
+        foreach (const auto& fileName, files) {
+            ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &m_index, environment(fileName))));
+            if (!session.unit()) {
+                qerr << "failed to parse " << fileName << endl;
+                continue;
+            }
+            ++parsed;
+
+            const auto imports = ClangHelpers::tuImports(session.unit());
+            QVector<IndexedString> includedFiles;
+            for (auto it = imports.constBegin(); it != imports.constEnd(); ++it) {
+                // like the parse job, don't track system headers
+                if (!clang_Location_isInSystemHeader(clang_getLocationForOffset(session.unit(), it.value().file, 0))) {
+                    includedFiles.append(canonicalPath(it.value().file));
+                }
+            }
+            m_index.setIncludedFiles(canonicalPath(session.mainFile()), includedFiles);
+        }
+        const auto parseAllTime = timer.elapsed();
+
+        const auto dependents = m_index.dependentTranslationUnits(IndexedString(QDir(header).canonicalPath()));
+        timer.restart();
+        foreach (const auto& tu, dependents) {
+            ParseSession session(ParseSessionData::Ptr(new ParseSessionData({}, &m_index, environment(tu.str()))));
+            if (!session.unit()) {
+                qerr << "failed to reparse " << tu.str() << endl;
+            }
+        }
+        const auto reparseTime = timer.elapsed();
+
+        qout << "parsed " << parsed << " translation units in " << parseAllTime << "ms" << endl;
+        qout << "touching " << header << " affects " << dependents.size() << " translation units, "
+             << "reparsing them took " << reparseTime << "ms" << endl;
+        return parsed == files.size() ? 0 : 255;
+    }
+
+    /**
+     * Benchmark indexing all translation units of the compilation database @p compileCommands,
+     * using @p threads threads, and print aggregate statistics
+     *
+     * The translation units are queued in the background parser of the clang plugin, such that they
+     * go through the full ClangParseJob pipeline as during the initial indexing of a project.
+     * The includes and defines are taken from the compile commands.
+     *
+     * @return the exit code
+     */
+    int benchCompileCommands(const QString& compileCommands, int threads)
+    {
+        const auto entries = readCompileCommands(compileCommands);
+        if (entries.isEmpty()) {
+            qerr << "no translation units found in " << compileCommands << endl;
+            return 255;
+        }
+
+        // the parse jobs require the core and the clang plugin
+        qputenv("KDEV_DISABLE_PLUGINS", "kdevcppsupport");
+        AutoTestShell::init({QStringLiteral("kdevclangsupport")});
+        TestCore::initialize();
+
+        CompileCommandsProvider provider;
+        QSet<IndexedString> pending;
+        for (auto entry : entries) {
+            const IndexedString url(entry.file);
+            entry.includes += toPathList(m_includePaths);
+            provider.addCommand(url.str(), entry);
+            pending.insert(url);
+        }
+        auto definesAndIncludes = IDefinesAndIncludesManager::manager();
+        definesAndIncludes->registerBackgroundProvider(&provider);
+
+        // the per translation unit timings are taken from the trace of the parse jobs
+        if (!ClangTrace::isEnabled()) {
+            ClangTrace::setEnabled(true);
+        }
+
+        auto backgroundParser = ICore::self()->languageController()->backgroundParser();
+        backgroundParser->setThreadCount(threads);
+        backgroundParser->setDelay(0);
+
+        QElapsedTimer timer;
+        timer.start();
+        QEventLoop loop;
+        QObject::connect(backgroundParser, &BackgroundParser::parseJobFinished, &loop, [&] (ParseJob* job) {
+            pending.remove(job->document());
+        });
+        QTimer idleTimer;
+        QObject::connect(&idleTimer, &QTimer::timeout, &loop, [&] {
+            // parse jobs may queue more work, e.g. for the dependents of a header
+            if (pending.isEmpty() && backgroundParser->isIdle()) {
+                loop.quit();
+            }
+        });
+        idleTimer.start(100);
+        for (const auto& entry : entries) {
+            backgroundParser->addDocument(IndexedString(entry.file), TopDUContext::VisibleDeclarationsAndContexts,
+                                          BackgroundParser::InitialParsePriority);
+        }
+        loop.exec();
+        const auto elapsed = timer.elapsed();
+
+        QVector<Result> results;
+        results.reserve(entries.size());
+        const auto durations = ClangTrace::durations("ClangParseJob::run");
+        QSet<IndexedString> files;
+        int parsed = 0;
+        {
+            DUChainReadLocker lock;
+            for (const auto& entry : entries) {
+                const IndexedString url(entry.file);
+                Result result;
+                result.file = entry.file;
+                result.time = durations.value(url.str()) / 1000;
+                if (auto context = DUChain::self()->chainForDocument(url)) {
+                    result.parsed = true;
+                    ++parsed;
+                    collectFiles(context, &files);
+                } else {
+                    qerr << "failed to parse " << entry.file << endl;
+                }
+                results.append(result);
+            }
+        }
+
+        qout << "indexed " << parsed << " of " << results.size() << " translation units in " << elapsed << "ms"
+             << " using " << threads << " threads, " << (elapsed ? 1000. * results.size() / elapsed : 0.) << " files/s" << endl;
+        const auto peakMemory = peakResidentSetSize();
+        if (peakMemory) {
+            qout << "peak resident set size: " << (peakMemory / 1024) << " MiB" << endl;
+        }
+
+        DUChainItemCounts counts;
+        {
+            DUChainReadLocker lock;
+            foreach (const auto& file, files) {
+                foreach (auto context, DUChain::self()->chainsForDocument(file)) {
+                    countItems(context, &counts);
+                }
+            }
+        }
+        qout << "DUChain: " << files.size() << " files, " << counts.contexts << " contexts, "
+             << counts.declarations << " declarations, " << counts.uses << " uses" << endl;
+
+        std::sort(results.begin(), results.end(), [] (const Result& lhs, const Result& rhs) {
+            return lhs.time > rhs.time;
+        });
+        qout << "slowest translation units:" << endl;
+        for (int i = 0; i < results.size() && i < 20; ++i) {
+            qout << "  " << results[i].time << "ms " << results[i].file << endl;
+        }
+
+        definesAndIncludes->unregisterBackgroundProvider(&provider);
+        TestCore::shutdown();
+        return parsed == results.size() ? 0 : 255;
+    }
+
 private:
+    struct CompileCommand
+    {
+        QString file;
+        Path::List includes;
+        QHash<QString, QString> defines;
+    };
+
+    struct Result
+    {
+        QString file;
+        bool parsed = false;
+        /// the time spent in the parse jobs of the translation unit
+        qint64 time = 0;
+    };
+
+    struct DUChainItemCounts
+    {
+        qint64 contexts = 0;
+        qint64 declarations = 0;
+        qint64 uses = 0;
+    };
+
+    /**
+     * Provides the includes and defines of the compile commands to the parse jobs
+     */
+    class CompileCommandsProvider : public IDefinesAndIncludesManager::BackgroundProvider
+    {
+    public:
+        void addCommand(const QString& file, const CompileCommand& command)
+        {
+            m_commands.insert(file, command);
+        }
+
+        Path::List includesInBackground(const QString& path) const override
+        {
+            return m_commands.value(path).includes;
+        }
+
+        Defines definesInBackground(const QString& path) const override
+        {
+            return m_commands.value(path).defines;
+        }
+
+        IDefinesAndIncludesManager::Type type() const override
+        {
+            return IDefinesAndIncludesManager::ProjectSpecific;
+        }
+
+    private:
+        /// not modified while the parse jobs run
+        QHash<QString, CompileCommand> m_commands;
+    };
+
+    /**
+     * @return the compile commands of the compilation database at @p path, with the includes and defines of each file
+     */
+    static QVector<CompileCommand> readCompileCommands(const QString& path)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qerr << "failed to open " << path << ": " << file.errorString() << endl;
+            return {};
+        }
+        QJsonParseError error;
+        const auto document = QJsonDocument::fromJson(file.readAll(), &error);
+        if (error.error != QJsonParseError::NoError || !document.isArray()) {
+            qerr << "failed to read " << path << ": " << error.errorString() << endl;
+            return {};
+        }
+
+        QVector<CompileCommand> commands;
+        foreach (const auto& value, document.array()) {
+            const auto entry = value.toObject();
+            const QDir directory(entry.value(QStringLiteral("directory")).toString());
+
+            QStringList arguments;
+            if (entry.contains(QStringLiteral("arguments"))) {
+                foreach (const auto& argument, entry.value(QStringLiteral("arguments")).toArray()) {
+                    arguments << argument.toString();
+                }
+            } else {
+                arguments = KShell::splitArgs(entry.value(QStringLiteral("command")).toString());
+            }
+
+            CompileCommand command;
+            command.file = directory.absoluteFilePath(entry.value(QStringLiteral("file")).toString());
+            for (int i = 0; i < arguments.size(); ++i) {
+                const auto& argument = arguments[i];
+                auto value = [&] (int prefixLength) {
+                    if (argument.size() > prefixLength) {
+                        return argument.mid(prefixLength);
+                    }
+                    return ++i < arguments.size() ? arguments[i] : QString();
+                };
+                if (argument.startsWith(QLatin1String("-isystem"))) {
+                    command.includes << Path(directory.absoluteFilePath(value(8)));
+                } else if (argument.startsWith(QLatin1String("-iquote"))) {
+                    command.includes << Path(directory.absoluteFilePath(value(7)));
+                } else if (argument.startsWith(QLatin1String("-I"))) {
+                    command.includes << Path(directory.absoluteFilePath(value(2)));
+                } else if (argument.startsWith(QLatin1String("-D"))) {
+                    const auto define = value(2);
+                    const int equals = define.indexOf(QLatin1Char('='));
+                    if (equals == -1) {
+                        command.defines.insert(define, QString());
+                    } else {
+                        command.defines.insert(define.left(equals), define.mid(equals + 1));
+                    }
+                }
+            }
+            commands.append(command);
+        }
+        return commands;
+    }
+
+    /**
+     * Collect the files of @p context and all contexts it imports, directly or indirectly
+     *
+     * NOTE: The DUChain must be locked
+     */
+    static void collectFiles(TopDUContext* context, QSet<IndexedString>* files)
+    {
+        if (files->contains(context->url())) {
+            return;
+        }
+        files->insert(context->url());
+        foreach (const auto& import, context->importedParentContexts()) {
+            if (auto imported = dynamic_cast<TopDUContext*>(import.context(nullptr))) {
+                collectFiles(imported, files);
+            }
+        }
+    }
+
+    static void countItems(DUContext* context, DUChainItemCounts* counts)
+    {
+        ++counts->contexts;
+        counts->declarations += context->localDeclarations().size();
+        counts->uses += context->usesCount();
+        foreach (auto child, context->childContexts()) {
+            countItems(child, counts);
+        }
+    }
+
+    /**
+     * @return the peak resident set size of this process in KiB, or zero if unknown
+     */
+    static qint64 peakResidentSetSize()
+    {
+        QFile status(QStringLiteral("/proc/self/status"));
+        if (!status.open(QIODevice::ReadOnly)) {
+            return 0;
+        }
+        foreach (const auto& line, status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+            }
+        }
+        return 0;
+    }
+
+    static IndexedString canonicalPath(CXFile file)
+    {
+        return IndexedString(QDir(ClangString(clang_getFileName(file)).toString()).canonicalPath());
+    }
+
     /**
      * actually run the parse session
      */
@@ -129,12 +485,36 @@ template<>
 void setupCustomArgs<ClangParser>(QCommandLineParser* args)
 {
     args->addOption(QCommandLineOption{QStringList{"I", "include"}, i18n("add include path"), "include"});
+    args->addOption(QCommandLineOption{QStringList{"touch-header"},
+                                       i18n("benchmark reparsing the given files that include this header after it changed"),
+                                       "header"});
+    args->addOption(QCommandLineOption{QStringList{"trace"},
+                                       i18n("write a trace of the parse phases in the Chrome trace event format to this file"),
+                                       "file"});
+    args->addOption(QCommandLineOption{QStringList{"compile-commands"},
+                                       i18n("benchmark indexing all translation units of this compilation database"),
+                                       "compile_commands.json"});
+    args->addOption(QCommandLineOption{QStringList{"j", "jobs"},
+                                       i18n("number of threads used with --compile-commands, defaults to the number of cores"),
+                                       "threads"});
 }
 
 template<>
 void setCustomArgs<ClangParser>(ClangParser* parser, QCommandLineParser* args)
 {
     parser->setIncludePaths(args->values("include"));
+    if (args->isSet("trace")) {
+        // the trace is written when the process exits
+        ClangTrace::setOutputFile(args->value("trace"));
+    }
+    if (args->isSet("touch-header")) {
+        // the benchmark parses the files on its own
+        exit(parser->benchTouchHeader(args->value("touch-header"), args->positionalArguments()));
+    }
+    if (args->isSet("compile-commands")) {
+        const int threads = args->isSet("jobs") ? args->value("jobs").toInt() : QThread::idealThreadCount();
+        exit(parser->benchCompileCommands(args->value("compile-commands"), qMax(1, threads)));
+    }
 }
 }
 
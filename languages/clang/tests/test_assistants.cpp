@@ -45,6 +45,8 @@
 
 #include <shell/documentcontroller.h>
 
+#include "../codegen/adaptsignatureassistant.h"
+
 using namespace KDevelop;
 using namespace KTextEditor;
 
@@ -53,6 +55,16 @@ QTEST_MAIN(TestAssistants)
 ForegroundLock *globalTestLock = 0;
 StaticAssistantsManager *staticAssistantsManager() { return Core::self()->languageController()->staticAssistantsManager(); }
 
+AdaptSignatureAssistant *adaptSignatureAssistant()
+{
+    foreach (const auto& assistant, staticAssistantsManager()->registeredAssistants()) {
+        if (auto adaptSignature = qobject_cast<AdaptSignatureAssistant*>(assistant.data())) {
+            return adaptSignature;
+        }
+    }
+    return nullptr;
+}
+
 void TestAssistants::initTestCase()
 {
     QLoggingCategory::setFilterRules(QStringLiteral(R"(
@@ -158,6 +170,10 @@ public:
         QCoreApplication::processEvents();
         if (waitForUpdate) {
             DUChain::self()->waitForUpdate(IndexedString(document.url), KDevelop::TopDUContext::AllDeclarationsAndContexts);
+            // the signature assistant compares the signatures in the background
+            auto assistant = adaptSignatureAssistant();
+            QVERIFY(assistant);
+            assistant->waitForDone();
         }
     }
 
@@ -454,7 +470,7 @@ void TestAssistants::testSignatureAssistant()
 
         if (stateChange.result == SHOULD_ASSIST) {
             QEXPECT_FAIL("change_function_type", "Clang sees that return type of out-of-line definition differs from that in the declaration and won't parse the code...", Abort);
-            QVERIFY(staticAssistantsManager()->activeAssistant() && !staticAssistantsManager()->activeAssistant()->actions().isEmpty());
+            QTRY_VERIFY(staticAssistantsManager()->activeAssistant() && !staticAssistantsManager()->activeAssistant()->actions().isEmpty());
         } else {
             QVERIFY(!staticAssistantsManager()->activeAssistant() || staticAssistantsManager()->activeAssistant()->actions().isEmpty());
         }
@@ -23,6 +23,7 @@
 #include "../util/clangutils.h"
 #include "../util/clangtypes.h"
 #include "../util/clangdebug.h"
+#include "../duchain/tokenhighlighting.h"
 
 #include <language/editor/documentrange.h>
 #include <tests/testcore.h>
@@ -281,3 +282,39 @@ void TestClangUtils::testRangeForIncludePathSpec()
     QCOMPARE(ClangUtils::rangeForIncludePathSpec("#include \"foo\\\".h\""), KTextEditor::Range(0, 10, 0, 17));
     QCOMPARE(ClangUtils::rangeForIncludePathSpec("#include \"foo<>.h\""), KTextEditor::Range(0, 10, 0, 17));
 }
+
+void TestClangUtils::testHighlightedTokens()
+{
+    const QByteArray code =
+        "int global = 0;\n"
+        "struct Foo { int member; };\n"
+        "int main(int argc)\n"
+        "{\n"
+        "    Foo foo;\n"
+        "    return foo.member + argc + global;\n"
+        "}\n";
+    CXTranslationUnit unit;
+    QString fileName;
+    parse(code, &unit, &fileName);
+    auto file = clang_getFile(unit, qPrintable(fileName));
+    QVERIFY(file);
+
+    using Container = HighlightingEnumContainer;
+    const QVector<HighlightedToken> expected = {
+        {{4, 4, 4, 7}, Container::ClassType, Container::ReferenceContext},
+        {{4, 8, 4, 11}, Container::LocalVariableType, Container::DefinitionContext},
+        {{5, 11, 5, 14}, Container::LocalVariableType, Container::ReferenceContext},
+        {{5, 15, 5, 21}, Container::MemberVariableType, Container::ReferenceContext},
+        {{5, 24, 5, 28}, Container::FunctionVariableType, Container::ReferenceContext},
+        {{5, 31, 5, 37}, Container::GlobalVariableType, Container::ReferenceContext},
+    };
+    const auto tokens = TokenHighlighting::highlightedTokens(unit, file, {4, 0, 5, 0});
+    QCOMPARE(tokens.size(), expected.size());
+    for (int i = 0; i < tokens.size(); ++i) {
+        QCOMPARE(tokens[i].range, expected[i].range);
+        QCOMPARE(tokens[i].type, expected[i].type);
+        QCOMPARE(tokens[i].context, expected[i].context);
+    }
+
+    clang_disposeTranslationUnit(unit);
+}
@@ -38,6 +38,7 @@ private slots:
     void testGetRawContents();
     void testGetRawContents_data();
     void testRangeForIncludePathSpec();
+    void testHighlightedTokens();
 };
 
 #endif // TESTCLANGUTILS_H
@@ -30,6 +30,7 @@
 #include <tests/testproject.h>
 
 #include "duchain/parsesession.h"
+#include "duchain/clangindex.h"
 #include "util/clangtypes.h"
 
 #include <interfaces/idocumentcontroller.h>
@@ -41,7 +42,9 @@
 
 #include "codecompletion/completionhelper.h"
 #include "codecompletion/context.h"
+#include "codecompletion/includedirectoryindex.h"
 #include "codecompletion/includepathcompletioncontext.h"
+#include "codecompletion/model.h"
 #include "../clangsettings/clangsettingsmanager.h"
 
 #include <KTextEditor/Editor>
@@ -50,6 +53,10 @@
 
 #include <KConfigGroup>
 
+#include <QSignalSpy>
+
+#include <functional>
+
 QTEST_MAIN(TestCodeCompletion);
 
 static const auto NoMacroOrBuiltin = ClangCodeCompletionContext::ContextFilters(
@@ -281,7 +288,10 @@ QExplicitlySharedDataPointer<IncludePathCompletionContext> executeIncludePathCom
         }
         textLength += position.column();
     }
-    auto context = new IncludePathCompletionContext(topPtr, sessionData, file->url().toUrl(), position, text.mid(0, textLength));
+    // the items are listed when the context is created, so the index isn't needed afterwards
+    IncludeDirectoryIndex directoryIndex;
+    auto context = new IncludePathCompletionContext(topPtr, sessionData, file->url().toUrl(), position, text.mid(0, textLength),
+                                                    &directoryIndex);
     return QExplicitlySharedDataPointer<IncludePathCompletionContext>{context};
 }
 
@@ -1204,3 +1214,48 @@ void TestCodeCompletion::testIgnoreGccBuiltins()
         executeCompletionTest(file.topContext(), {});
     }
 }
+
+void TestCodeCompletion::testReuseCompletionItems()
+{
+    TestFile file("struct Foo { int member; };\nint main() { Foo f; f.me }\n", "cpp");
+    QVERIFY(file.parseAndWait(TopDUContext::AllDeclarationsContextsUsesAndAST));
+
+    ClangIndex index;
+    ClangCodeCompletionModel model(&index, nullptr);
+    model.initialize();
+    auto view = createView(file.url().toUrl(), this);
+
+    // the completion position is the start of the typed identifier, as in the editor
+    const KTextEditor::Cursor position(1, 22);
+    auto complete = [&]() {
+        QSignalSpy spy(&model, &QAbstractItemModel::modelReset);
+        model.completionInvoked(view.get(), {position, {1, 24}}, KTextEditor::CodeCompletionModel::AutomaticInvocation);
+        while ((spy.isEmpty() || !model.rowCount()) && spy.wait(5000)) {
+        }
+
+        // referenced, so that new items can't be allocated at the same addresses
+        QList<CompletionTreeElementPointer> items;
+        std::function<void (const QModelIndex&)> collect = [&] (const QModelIndex& parent) {
+            for (int row = 0; row < model.rowCount(parent); ++row) {
+                const auto child = model.index(row, 0, parent);
+                if (model.rowCount(child)) {
+                    collect(child);
+                } else if (auto item = model.itemForIndex(child)) {
+                    items << CompletionTreeElementPointer(item);
+                }
+            }
+        };
+        collect({});
+        return items;
+    };
+
+    const auto items = complete();
+    QVERIFY(!items.isEmpty());
+
+    // requesting completion at the same position again reuses the items of the first request
+    const auto reused = complete();
+    QCOMPARE(reused.size(), items.size());
+    foreach (const auto& item, reused) {
+        QVERIFY(items.contains(item));
+    }
+}
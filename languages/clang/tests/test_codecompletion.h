@@ -58,6 +58,8 @@ private slots:
     void testCompleteFunction();
 
     void testIgnoreGccBuiltins();
+
+    void testReuseCompletionItems();
 };
 
 #endif // TESTCODECOMPLETION_H
@@ -66,10 +66,25 @@ private slots:
     void testFunctionDefinitionVsDeclaration();
     void testEnsureNoDoubleVisit();
     void testReparseWithAllDeclarationsContextsAndUses();
+    void testSkipFunctionBodies();
+    void testDeclarationCache();
+    void testPersistentPinnedTranslationUnits();
+    void testPersistentIncludedFiles();
+    void testPchCache();
+    void testPchWithUnsavedDependency();
+    void testTranslationUnitCache();
+    void testSharedPreambles();
+    void testUnsavedFileCache();
+    void testTranslationUnitTrimmer();
+    void testHeaderNameIndex();
+    void testBuddyFileIndex();
+    void testTranslationUnitForUnindexedBuddy();
     void testReparseOnDocumentActivated();
     void testParsingEnvironment();
     void testSystemIncludes();
     void testReparseInclude();
+    void testReparseUnchangedHeader();
+    void testReparseDependentsOnHeaderSave();
     void testReparseChangeEnvironment();
     void testMacrosRanges();
     void testNestedImports();
@@ -88,6 +103,10 @@ private slots:
     void testTypeAliasTemplate();
 
     void benchDUChainBuilder();
+    void benchDUChainBuilderUses_data();
+    void benchDUChainBuilderUses();
+    void benchMainFileFirst_data();
+    void benchMainFileFirst();
     void testGccCompatibility();
     void testQtIntegration();
 
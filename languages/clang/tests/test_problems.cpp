@@ -20,7 +20,9 @@
 
 #include "../duchain/clangindex.h"
 #include "../duchain/clangproblem.h"
+#include "../duchain/headernameindex.h"
 #include "../duchain/parsesession.h"
+#include "../duchain/todoextractor.h"
 #include "../duchain/unknowndeclarationproblem.h"
 #include "../util/clangtypes.h"
 
@@ -38,6 +40,8 @@
 #include <interfaces/ilanguagecontroller.h>
 
 #include <QtTest/QTest>
+#include <QFile>
+#include <QTemporaryDir>
 #include <QLoggingCategory>
 
 #include <ktexteditor_version.h>
@@ -260,6 +264,21 @@ void TestProblems::testMissingInclude()
     QCOMPARE(fixits[2].replacementText, QString("#include \"%1\"\n").arg(include.url().toUrl().fileName()));
 }
 
+void TestProblems::testMissingIncludeIgnoresCase()
+{
+    // e.g. QString is declared in qstring.h
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    for (const auto& name : {QStringLiteral("camelcase.h"), QStringLiteral("CamelCaseHelper.h"), QStringLiteral("camel.h")}) {
+        QFile file(dir.path() + QLatin1Char('/') + name);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+    }
+
+    HeaderNameIndex index;
+    const auto headers = index.headersForIdentifier(QStringLiteral("CamelCase"), {Path(dir.path())});
+    QCOMPARE(headers, QStringList({dir.path() + QStringLiteral("/CamelCaseHelper.h"), dir.path() + QStringLiteral("/camelcase.h")}));
+}
+
 struct ExpectedTodo
 {
     QString description;
@@ -297,13 +316,7 @@ void TestProblems::testTodoProblems_data()
     QTest::addColumn<QString>("code");
     QTest::addColumn<ExpectedTodos>("expectedTodos");
 
-    // we have two problems here:
-    // - we cannot search for comments without declarations,
-    //   that means: we can only search inside doxygen-style comments
-    //   possible fix: -fparse-all-comments -- however: libclang API is lacking here again.
-    //   Can only search through comments attached to a valid entity in the AST
-    // - we cannot detect the correct location of the comment yet
-    // see more comments inside TodoExtractor
+    // the comments are found by scanning the raw file contents, see TodoExtractor
     QTest::newRow("simple1")
         << "/** TODO: Something */\n/** notodo */\n"
         << ExpectedTodos{{"TODO: Something", {0, 4}, {0, 19}}};
@@ -331,6 +344,53 @@ void TestProblems::testTodoProblems_data()
     QTest::newRow("non-ascii-todo")
         << "/* TODO: 例えば */"
         << ExpectedTodos{{"TODO: 例えば", {0, 3}, {0, 12}}};
+    QTest::newRow("trailing-comment")
+        << "int i; // TODO: foo\n"
+        << ExpectedTodos{{"TODO: foo", {0, 10}, {0, 19}}};
+    QTest::newRow("todo-in-string")
+        << "const char* s = \"// TODO: no\";\nconst char* t = \"/* TODO: no */\";\n"
+        << ExpectedTodos{};
+    QTest::newRow("todo-after-char-literal")
+        << "char c = '\"'; // TODO: quote\n"
+        << ExpectedTodos{{"TODO: quote", {0, 17}, {0, 28}}};
+    QTest::newRow("todo-after-raw-string")
+        << "const char* r = R\"x(// TODO: no)x\"; // TODO: yes\n"
+        << ExpectedTodos{{"TODO: yes", {0, 39}, {0, 48}}};
+}
+
+void TestProblems::benchTodoExtractor_data()
+{
+    QTest::addColumn<int>("todoInterval");
+
+    QTest::newRow("no-todos") << 0;
+    QTest::newRow("todo-every-100-lines") << 100;
+}
+
+void TestProblems::benchTodoExtractor()
+{
+    QFETCH(int, todoInterval);
+
+    // a header of 20000 lines, with a mix of code, comments and string literals
+    const int lines = 20000;
+    QByteArray contents;
+    int expectedTodos = 0;
+    for (int i = 0; i < lines; i += 4) {
+        if (todoInterval && i % todoInterval == 0) {
+            contents += "/// TODO: item " + QByteArray::number(i) + "\n";
+            ++expectedTodos;
+        } else {
+            contents += "/// Documentation of function " + QByteArray::number(i) + "\n";
+        }
+        contents += "int function" + QByteArray::number(i) + "(int arg); // trailing comment\n";
+        contents += "const char* string" + QByteArray::number(i) + " = \"/* not a comment */\";\n";
+        contents += "/* some block comment */\n";
+    }
+
+    const IndexedString path(QStringLiteral("/tmp/bench.h"));
+    QBENCHMARK {
+        TodoExtractor extractor(contents, path);
+        QCOMPARE(extractor.problems().size(), expectedTodos);
+    }
 }
 
 void TestProblems::testProblemsForIncludedFiles()
@@ -361,6 +421,64 @@ void TestProblems::testProblemsForIncludedFiles()
 
 using RangeList = QVector<KTextEditor::Range>;
 
+void TestProblems::testManyDiagnostics()
+{
+    // 5100 warnings spread over 300 headers
+    const int numHeaders = 300;
+    const int warningsPerHeader = 17;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QVector<QByteArray> headers;
+    QString mainContents;
+    for (int i = 0; i < numHeaders; ++i) {
+        const QString header = dir.path() + QStringLiteral("/header%1.h").arg(i);
+        QFile file(header);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("#pragma once\n");
+        for (int j = 0; j < warningsPerHeader; ++j) {
+            file.write("#warning \"warning " + QByteArray::number(j) + "\"\n");
+        }
+        headers << header.toUtf8();
+        mainContents += QStringLiteral("#include \"%1\"\n").arg(header);
+    }
+
+    const QString mainFile = dir.path() + QStringLiteral("/main.cpp");
+    ClangIndex index;
+    ClangParsingEnvironment environment;
+    environment.setTranslationUnitUrl(IndexedString(mainFile));
+    ParseSession session(ParseSessionData::Ptr(new ParseSessionData({UnsavedFile(mainFile, {mainContents})},
+                                                                    &index, environment)));
+    QVERIFY(session.unit());
+
+    auto verifyProblems = [&]() {
+        int numProblems = 0;
+        foreach (const auto& header, headers) {
+            const auto file = session.file(header);
+            QVERIFY(file);
+            const auto problems = session.problemsForFile(file);
+            QCOMPARE(problems.size(), warningsPerHeader);
+            for (int j = 0; j < warningsPerHeader; ++j) {
+                QCOMPARE(problems[j]->severity(), IProblem::Warning);
+                QCOMPARE(problems[j]->finalLocation().document.byteArray(), header);
+                QCOMPARE(problems[j]->finalLocation().start().line(), j + 1);
+            }
+            numProblems += problems.size();
+        }
+        QCOMPARE(numProblems, numHeaders * warningsPerHeader);
+    };
+
+    verifyProblems();
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+
+    // the problems of the unchanged diagnostics get reused
+    QVERIFY(session.reparse({UnsavedFile(mainFile, {mainContents})}, environment));
+    verifyProblems();
+}
+
 void TestProblems::testRanges_data()
 {
     QTest::addColumn<QByteArray>("code");
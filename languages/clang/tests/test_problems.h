@@ -38,13 +38,17 @@ private slots:
     void testRanges_data();
     void testRanges();
     void testProblemsForIncludedFiles();
+    void testManyDiagnostics();
 
     void testFixits();
     void testFixits_data();
     void testTodoProblems();
     void testTodoProblems_data();
+    void benchTodoExtractor();
+    void benchTodoExtractor_data();
 
     void testMissingInclude();
+    void testMissingIncludeIgnoresCase();
     void testSeverity();
     void testSeverity_data();
 };
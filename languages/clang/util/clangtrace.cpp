@@ -0,0 +1,276 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#include "clangtrace.h"
+
+#include "clangdebug.h"
+#include "clangtypes.h"
+
+#include <serialization/indexedstring.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+
+#include <atomic>
+
+using namespace KDevelop;
+
+namespace {
+
+/// beyond this, events are dropped to bound the memory usage
+const int maxEvents = 1000000;
+
+struct Event
+{
+    const char* name;
+    QString file;
+    int thread;
+    /// in microseconds
+    qint64 start;
+    qint64 duration;
+    QVector<QPair<const char*, qint64>> arguments;
+};
+
+std::atomic<bool> s_enabled(qEnvironmentVariableIsSet("KDEV_CLANG_TRACE"));
+
+/// the time this thread waited for locks, in microseconds
+thread_local qint64 t_lockWait = 0;
+
+struct TraceData
+{
+    TraceData()
+        : outputFile(QString::fromLocal8Bit(qgetenv("KDEV_CLANG_TRACE")))
+    {
+        clock.start();
+    }
+
+    ~TraceData()
+    {
+        if (!events.isEmpty()) {
+            writeEvents();
+        }
+    }
+
+    qint64 now() const
+    {
+        return clock.nsecsElapsed() / 1000;
+    }
+
+    /// NOTE: mutex must be locked when calling this
+    bool writeEvents() const
+    {
+        if (outputFile.isEmpty()) {
+            return false;
+        }
+
+        const qint64 pid = QCoreApplication::applicationPid();
+        QJsonArray traceEvents;
+        foreach (const auto& event, events) {
+            QJsonObject arguments;
+            if (!event.file.isEmpty()) {
+                arguments.insert(QStringLiteral("file"), event.file);
+            }
+            foreach (const auto& argument, event.arguments) {
+                arguments.insert(QString::fromLatin1(argument.first), static_cast<double>(argument.second));
+            }
+            traceEvents.append(QJsonObject{
+                {QStringLiteral("name"), QString::fromLatin1(event.name)},
+                {QStringLiteral("cat"), QStringLiteral("clang")},
+                {QStringLiteral("ph"), QStringLiteral("X")},
+                {QStringLiteral("ts"), static_cast<double>(event.start)},
+                {QStringLiteral("dur"), static_cast<double>(event.duration)},
+                {QStringLiteral("pid"), static_cast<double>(pid)},
+                {QStringLiteral("tid"), event.thread},
+                {QStringLiteral("args"), arguments}
+            });
+        }
+        const QJsonObject trace{
+            {QStringLiteral("traceEvents"), traceEvents},
+            {QStringLiteral("displayTimeUnit"), QStringLiteral("ms")}
+        };
+
+        QSaveFile file(outputFile);
+        if (!file.open(QIODevice::WriteOnly)
+            || file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) == -1 || !file.commit())
+        {
+            qCWarning(KDEV_CLANG) << "Failed to write the clang trace to" << outputFile << file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QString outputFile;
+    QVector<Event> events;
+    /// small sequential ids for the threads, they are easier to tell apart in the trace viewer
+    QHash<Qt::HANDLE, int> threads;
+    bool dropped = false;
+};
+
+TraceData& traceData()
+{
+    static TraceData data;
+    return data;
+}
+
+}
+
+namespace ClangTrace {
+
+bool isEnabled()
+{
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+void setOutputFile(const QString& path)
+{
+    auto& data = traceData();
+    QMutexLocker lock(&data.mutex);
+    data.outputFile = path;
+    s_enabled = !path.isEmpty();
+}
+
+void setEnabled(bool enabled)
+{
+    s_enabled = enabled;
+}
+
+QHash<QString, qint64> durations(const char* name)
+{
+    auto& data = traceData();
+    QMutexLocker lock(&data.mutex);
+    QHash<QString, qint64> durations;
+    foreach (const auto& event, data.events) {
+        // the names are literals, but not necessarily the same across libraries
+        if (qstrcmp(event.name, name) == 0) {
+            durations[event.file] += event.duration;
+        }
+    }
+    return durations;
+}
+
+QPair<qint64, int> maximumDuration(const char* name)
+{
+    auto& data = traceData();
+    QMutexLocker lock(&data.mutex);
+    QPair<qint64, int> maximum(0, 0);
+    foreach (const auto& event, data.events) {
+        if (qstrcmp(event.name, name) == 0) {
+            maximum.first = qMax(maximum.first, event.duration);
+            ++maximum.second;
+        }
+    }
+    return maximum;
+}
+
+void clear()
+{
+    auto& data = traceData();
+    QMutexLocker lock(&data.mutex);
+    data.events.clear();
+    data.dropped = false;
+}
+
+bool write()
+{
+    auto& data = traceData();
+    QMutexLocker lock(&data.mutex);
+    return data.writeEvents();
+}
+
+Scope::Scope(const char* name, Kind kind)
+    : m_name(name)
+    , m_kind(kind)
+    , m_active(isEnabled())
+{
+    if (m_active) {
+        m_start = traceData().now();
+        m_lockWaitStart = t_lockWait;
+    }
+}
+
+Scope::Scope(const char* name, const IndexedString& file)
+    : Scope(name)
+{
+    if (m_active) {
+        m_file = file.str();
+    }
+}
+
+Scope::Scope(const char* name, CXFile file)
+    : Scope(name)
+{
+    if (m_active) {
+        m_file = ClangString(clang_getFileName(file)).toString();
+    }
+}
+
+Scope::~Scope()
+{
+    finish();
+}
+
+void Scope::setArgument(const char* name, qint64 value)
+{
+    if (m_active) {
+        m_arguments.append({name, value});
+    }
+}
+
+void Scope::finish()
+{
+    if (!m_active) {
+        return;
+    }
+    m_active = false;
+
+    auto& data = traceData();
+    const auto duration = data.now() - m_start;
+    if (m_kind == LockWait) {
+        t_lockWait += duration;
+    } else if (t_lockWait > m_lockWaitStart) {
+        m_arguments.append({"lock wait (us)", t_lockWait - m_lockWaitStart});
+    }
+
+    QMutexLocker lock(&data.mutex);
+    if (data.events.size() >= maxEvents) {
+        if (!data.dropped) {
+            qCWarning(KDEV_CLANG) << "Too many trace events, dropping the following ones";
+            data.dropped = true;
+        }
+        return;
+    }
+    const auto thread = QThread::currentThreadId();
+    auto it = data.threads.find(thread);
+    if (it == data.threads.end()) {
+        it = data.threads.insert(thread, data.threads.size() + 1);
+    }
+    data.events.append({m_name, m_file, *it, m_start, duration, m_arguments});
+}
+
+}
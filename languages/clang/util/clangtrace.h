@@ -0,0 +1,137 @@
+/*
+    This file is part of KDevelop
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef CLANGTRACE_H
+#define CLANGTRACE_H
+
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include <clang-c/Index.h>
+
+#include "clangprivateexport.h"
+
+namespace KDevelop {
+class IndexedString;
+}
+
+/**
+ * Tracing of the clang parse pipeline in the Chrome trace event format
+ *
+ * Tracing is enabled by setting the KDEV_CLANG_TRACE environment variable to the path of the output file,
+ * which is written when the process exits. Open it in chrome://tracing to see where the time goes.
+ * When disabled, a trace scope costs a single atomic load.
+ */
+namespace ClangTrace {
+
+/**
+ * @return true when trace events are recorded
+ */
+KDEVCLANGPRIVATE_EXPORT bool isEnabled();
+
+/**
+ * Enable tracing and write the recorded events to @p path, an empty @p path disables tracing
+ */
+KDEVCLANGPRIVATE_EXPORT void setOutputFile(const QString& path);
+
+/**
+ * Record trace events, also without output file, e.g. to query them via @ref durations
+ */
+KDEVCLANGPRIVATE_EXPORT void setEnabled(bool enabled);
+
+/**
+ * @return the total time in microseconds spent in the recorded scopes called @p name, per file
+ */
+KDEVCLANGPRIVATE_EXPORT QHash<QString, qint64> durations(const char* name);
+
+/**
+ * @return the longest time in microseconds spent in a single recorded scope called @p name, and the number of such scopes
+ */
+KDEVCLANGPRIVATE_EXPORT QPair<qint64, int> maximumDuration(const char* name);
+
+/**
+ * Discard all events recorded so far
+ */
+KDEVCLANGPRIVATE_EXPORT void clear();
+
+/**
+ * Write all events recorded so far to the output file
+ *
+ * @return false when the file could not be written
+ */
+KDEVCLANGPRIVATE_EXPORT bool write();
+
+/**
+ * Records the time spent in a scope as a trace event
+ *
+ * The time spent waiting for locks within the scope is added as an argument.
+ */
+class KDEVCLANGPRIVATE_EXPORT Scope
+{
+public:
+    enum Kind {
+        Work,
+        /// the scope waits for a lock, its time is accounted to the enclosing scopes as lock wait time
+        LockWait
+    };
+
+    /**
+     * @p name must be a string literal, it is recorded only when the scope is finished
+     */
+    explicit Scope(const char* name, Kind kind = Work);
+    Scope(const char* name, const KDevelop::IndexedString& file);
+    Scope(const char* name, CXFile file);
+    ~Scope();
+
+    /**
+     * @return true when this scope gets recorded, use this to skip computing expensive arguments
+     */
+    bool isActive() const
+    {
+        return m_active;
+    }
+
+    /**
+     * Add the counter @p value as argument @p name, which must be a string literal
+     */
+    void setArgument(const char* name, qint64 value);
+
+    /**
+     * Record the scope now instead of when it gets destroyed
+     */
+    void finish();
+
+private:
+    Q_DISABLE_COPY(Scope)
+
+    const char* m_name;
+    Kind m_kind;
+    bool m_active;
+    qint64 m_start = 0;
+    qint64 m_lockWaitStart = 0;
+    QString m_file;
+    QVector<QPair<const char*, qint64>> m_arguments;
+};
+
+}
+
+#endif // CLANGTRACE_H
@@ -393,3 +393,18 @@ ClangUtils::SpecialQtAttributes ClangUtils::specialQtAttributes(CXCursor cursor)
     }
     return qtAttribute;
 }
+
+quint64 ClangUtils::memoryUsage(CXTranslationUnit unit)
+{
+    if (!unit) {
+        return 0;
+    }
+
+    quint64 bytes = 0;
+    const auto usage = clang_getCXTUResourceUsage(unit);
+    for (unsigned int i = 0; i < usage.numEntries; ++i) {
+        bytes += usage.entries[i].amount;
+    }
+    clang_disposeCXTUResourceUsage(usage);
+    return bytes;
+}
@@ -165,6 +165,11 @@ namespace ClangUtils
      * Given a cursor representing a CXXmethod
      */
     SpecialQtAttributes specialQtAttributes(CXCursor cursor);
+
+    /**
+     * @return the memory used by translation unit @p unit in bytes, as reported by clang_getCXTUResourceUsage
+     */
+    KDEVCLANGPRIVATE_EXPORT quint64 memoryUsage(CXTranslationUnit unit);
 };
 
 #endif // CLANGUTILS_H